@@ -0,0 +1,32 @@
+#ifndef CANCEL_TOKEN_H
+#define CANCEL_TOKEN_H
+
+#include <atomic>
+
+namespace Cave {
+
+//
+// Set from any thread to ask a generation to stop. The stages check it
+// between CA reps, fixUp passes and rows of the room labelling and
+// smoothing, then generate returns rejected with CANCELLED.
+//
+class CancelToken {
+public:
+  void cancel() { mCancelled.store(true, std::memory_order_relaxed); }
+  void reset() { mCancelled.store(false, std::memory_order_relaxed); }
+  bool isCancelled() const {
+    return mCancelled.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<bool> mCancelled{false};
+};
+
+// No token = never cancelled
+inline bool isCancelled(const CancelToken *token) {
+  return token && token->isCancelled();
+}
+
+} // namespace Cave
+
+#endif
@@ -1,15 +1,19 @@
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <set>
 
 #include "Cave.h"
 #include "CaveSmoother.h"
+#include "CellularAutomata.h"
 #include "DisjointSets.h"
+#include "NoiseKernel.h"
 #include "PerlinNoise.h"
 #include "RandSimple.h"
-#include "RogueCave.hpp"
+#include "RoomLabeler.h"
 #include "SimplexNoise.h"
 #include "TileTypes.h"
+#include "Trace.h"
 
 #include "Debug.h"
 
@@ -20,32 +24,184 @@ Cave::Cave(CaveInfo &info, const GenerationParams &params)
 
 Cave::~Cave() {}
 
-TileMap Cave::generate() {
+TileMap Cave::generate(RoomGraph *pRoomGraph) {
   //
   // The TileMap is bordered with 1 tile wall. To make the loops easier? the X,Y
   // of the non-border corner is 0,0 and getMapPos translates it to 1,1.
   // Therefore -1,-1 is the top left corner of the border wall of TileMap.
   //
+  TraceScope trace("generate");
   TileMap tileMap(mInfo.mCaveHeight + 2,
                   std::vector<int>(mInfo.mCaveWidth + 2));
+  mStats.clear();
+
+  auto lap = std::chrono::steady_clock::now();
+  if (mParams.mPyramidScale > 1) {
+    runPyramid(tileMap);
+  } else {
+    initialise(tileMap);
+    endStage(STAGE_NOISE, lap);
+    runCellularAutomata(tileMap, mParams.mGenerations);
+  }
+  endStage(STAGE_CA, lap);
+  return finish(tileMap, pRoomGraph, lap);
+}
+
+std::vector<uint8_t> Cave::runSteps(int steps, const std::vector<uint8_t> *from,
+                                    int fromSteps) {
+  TraceScope trace("run_steps");
+  const int W = mInfo.mCaveWidth;
+  const int H = mInfo.mCaveHeight;
+  steps = std::max(0, std::min(steps, (int)mParams.mGenerations.size()));
+  if (!from) {
+    fromSteps = 0;
+  }
+  auto lap = std::chrono::steady_clock::now();
+  CellularAutomata cave(W, H, mParams.mGridLayout);
+  cave.setCancelToken(mCancel);
+  if (from) {
+    for (int cy = 0; cy < H; ++cy) {
+      for (int cx = 0; cx < W; ++cx) {
+        cave.setWall(cx, cy, (*from)[cy * W + cx] != 0);
+      }
+    }
+  } else {
+    RNG::RandSimple simple(mParams.seed);
+    std::vector<uint8_t> walls;
+    for (int cy = 0; cy < H; ++cy) {
+      noiseRow(cy, simple, walls);
+      for (int cx = 0; cx < W; ++cx) {
+        cave.setWall(cx, cy, walls[cx] != 0);
+      }
+    }
+    addStage(STAGE_NOISE, lap);
+  }
+  for (int i = fromSteps; i < steps; ++i) {
+    TraceScope stepTrace("ca_step", i);
+    mStats.mSteps.push_back(
+        cave.runStep(mParams.mGenerations[i], mParams.mDetectOscillation));
+  }
+  addStage(STAGE_CA, lap);
+  if (isCancelled(mCancel))
+    return {};
+
+  std::vector<uint8_t> cells(W * H);
+  for (int cy = 0; cy < H; ++cy) {
+    for (int cx = 0; cx < W; ++cx) {
+      cells[cy * W + cx] = cave.isWall(cx, cy) ? 1 : 0;
+    }
+  }
+  return cells;
+}
+
+TileMap Cave::generateFrom(const std::vector<uint8_t> &cells,
+                           RoomGraph *pRoomGraph) {
+  TraceScope trace("generate");
+  TileMap tileMap(mInfo.mCaveHeight + 2,
+                  std::vector<int>(mInfo.mCaveWidth + 2));
+  // Keep what runSteps did
+  GenerationStats ran = std::move(mStats);
+  mStats.clear();
+  mStats.mSteps = std::move(ran.mSteps);
+  mStats.mStageMs[STAGE_NOISE] = ran.mStageMs[STAGE_NOISE];
+  mStats.mStageMs[STAGE_CA] = ran.mStageMs[STAGE_CA];
+
+  auto lap = std::chrono::steady_clock::now();
+  makeBorder(tileMap);
+  for (int cy = 0; cy < mInfo.mCaveHeight; ++cy) {
+    for (int cx = 0; cx < mInfo.mCaveWidth; ++cx) {
+      setCell(tileMap, cx, cy,
+              cells[cy * mInfo.mCaveWidth + cx] ? WALL : FLOOR);
+    }
+  }
+  return finish(tileMap, pRoomGraph, lap);
+}
+
+void Cave::endStage(Stage stage, std::chrono::steady_clock::time_point &lap) {
+  const auto now = std::chrono::steady_clock::now();
+  mStats.mStageMs[stage] =
+      std::chrono::duration<float, std::milli>(now - lap).count();
+  lap = now;
+}
+
+void Cave::addStage(Stage stage, std::chrono::steady_clock::time_point &lap) {
+  const float ms = mStats.mStageMs[stage];
+  endStage(stage, lap);
+  mStats.mStageMs[stage] += ms;
+}
 
-  initialise(tileMap);
-  runCellularAutomata(tileMap);
+//
+// Everything after the CA: the acceptance checks, fixUp, the rooms and
+// the tunnels between them and the smoothing
+//
+TileMap Cave::finish(TileMap &tileMap, RoomGraph *pRoomGraph,
+                     std::chrono::steady_clock::time_point &lap) {
+  const AcceptanceCriteria &accept = mParams.mAccept;
+  if (isCancelled(mCancel)) {
+    return reject(CANCELLED);
+  }
+  mStats.mFloorRatio = floorRatio(tileMap);
+  if (mStats.mFloorRatio < accept.mMinFloorRatio ||
+      mStats.mFloorRatio > accept.mMaxFloorRatio) {
+    return reject(REJECT_FLOOR_RATIO);
+  }
   fixUp(tileMap);
+  endStage(STAGE_FIXUP, lap);
   auto floorMaps = findRooms(tileMap);
-  joinRooms(tileMap, floorMaps);
+  if (isCancelled(mCancel)) {
+    return reject(CANCELLED);
+  }
+  cullSmallRooms(tileMap, floorMaps);
+  endStage(STAGE_ROOMS, lap);
+  mStats.mRoomCount = floorMaps.second.size();
+  if (mStats.mRoomCount < accept.mMinRooms ||
+      (accept.mMaxRooms >= 0 && mStats.mRoomCount > accept.mMaxRooms)) {
+    return reject(REJECT_ROOM_COUNT);
+  }
+  auto mst = joinRooms(tileMap, floorMaps);
+  mStats.mTunnelCount = mst.size();
+  if (accept.mMaxTunnels >= 0 && mStats.mTunnelCount > accept.mMaxTunnels) {
+    return reject(REJECT_TUNNEL_COUNT);
+  }
+  if (pRoomGraph) {
+    buildRoomGraph(floorMaps, mst, *pRoomGraph);
+  }
+  endStage(STAGE_JOIN, lap);
   smooth(tileMap);
+  endStage(STAGE_SMOOTH, lap);
+  if (isCancelled(mCancel)) {
+    return reject(CANCELLED);
+  }
 
   return tileMap;
 }
 
-void Cave::initialise(TileMap &tileMap) {
-  RNG::RandSimple simple(mParams.seed);
+TileMap Cave::reject(Rejection rejection) {
+  LOG_INFO("CAVE REJECTED: " << rejection << " floor: " << mStats.mFloorRatio
+                             << " rooms: " << mStats.mRoomCount
+                             << " tunnels: " << mStats.mTunnelCount);
+  mStats.mRejection = rejection;
+  return TileMap();
+}
 
-  //
-  // Make the border
-  // - Top/Bottom
-  //
+float Cave::floorRatio(const TileMap &tileMap) {
+  const int cells = mInfo.mCaveWidth * mInfo.mCaveHeight;
+  if (cells <= 0)
+    return 0;
+  int floors = 0;
+  for (int cy = 0; cy < mInfo.mCaveHeight; ++cy) {
+    for (int cx = 0; cx < mInfo.mCaveWidth; ++cx) {
+      floors += isFloor(tileMap, cx, cy) ? 1 : 0;
+    }
+  }
+  return (float)floors / cells;
+}
+
+//
+// The 1 cell wall round the TileMap
+// - Top/Bottom
+//
+void Cave::makeBorder(TileMap &tileMap) {
   for (int cx = 0; cx < 2 + mInfo.mCaveWidth; ++cx) {
     setCell(tileMap, cx - 1, -1, WALL);
     setCell(tileMap, cx - 1, mInfo.mCaveHeight, WALL);
@@ -55,174 +211,267 @@ void Cave::initialise(TileMap &tileMap) {
     setCell(tileMap, -1, cy - 1, WALL);
     setCell(tileMap, mInfo.mCaveWidth, cy - 1, WALL);
   }
+}
 
-  //
-  // Fill with random or perlin
-  //
+void Cave::initialise(TileMap &tileMap) {
+  TraceScope trace("noise");
+  RNG::RandSimple simple(mParams.seed);
+
+  makeBorder(tileMap);
+
+  std::vector<uint8_t> walls;
+  for (int cy = 0; cy < mInfo.mCaveHeight; ++cy) {
+    if (isCancelled(mCancel))
+      return;
+    noiseRow(cy, simple, walls);
+    for (int cx = 0; cx < mInfo.mCaveWidth; ++cx) {
+      setCell(tileMap, cx, cy, walls[cx] ? WALL : FLOOR);
+    }
+  }
+}
+
+//
+// Fill with random or perlin. The random fill takes the next
+// mCaveWidth numbers from simple, so the rows have to be done in order.
+//
+void Cave::noiseRow(int cy, RNG::RandSimple &simple,
+                    std::vector<uint8_t> &walls) {
+  walls.resize(mInfo.mCaveWidth);
   const double W = mInfo.mCaveWidth - 1 + mParams.mAmp;
   const double H = mInfo.mCaveHeight - 1 + mParams.mAmp;
+  //
+  // The vectorised kernel does a row per call, falling back to the library
+  // noise where it might not agree with it (see NoiseKernel::fillWalls).
+  //
+  if (mParams.mPerlin) {
+    if ((int)mNoiseXs.size() != mInfo.mCaveWidth) {
+      mNoiseXs.resize(mInfo.mCaveWidth);
+      for (int cx = 0; cx < mInfo.mCaveWidth; ++cx) {
+        mNoiseXs[cx] = cx / W * mParams.mFreq;
+      }
+    }
+    NoiseKernel::fillWalls(mNoiseXs.data(), cy / H * mParams.mFreq,
+                           mInfo.mCaveWidth, mParams.mOctaves, walls.data());
+    return;
+  }
   double (*pf)(double, double, int) =
       mParams.mPerlin ? &Algo::getSNoise2 : &Algo::getNoise2;
-  for (int cy = 0; cy < mInfo.mCaveHeight; ++cy) {
-    for (int cx = 0; cx < mInfo.mCaveWidth; ++cx) {
-      double x = cx / W * mParams.mFreq;
-      double y = cy / H * mParams.mFreq;
-      double n1 = mParams.mPerlin
-                      ? (*pf)(x, y, mParams.mOctaves)
-                      : abs(simple.getFloat()) - mParams.mWallChance;
-      setCell(tileMap, cx, cy, (n1 < 0) ? WALL : FLOOR);
-    }
+  for (int cx = 0; cx < mInfo.mCaveWidth; ++cx) {
+    double x = cx / W * mParams.mFreq;
+    double y = cy / H * mParams.mFreq;
+    double n1 = mParams.mPerlin ? (*pf)(x, y, mParams.mOctaves)
+                                : abs(simple.getFloat()) - mParams.mWallChance;
+    walls[cx] = (n1 < 0) ? 1 : 0;
   }
 }
 
-void Cave::runCellularAutomata(TileMap &tileMap) {
-  if (!mParams.mGenerations.empty()) {
+void Cave::runCellularAutomata(
+    TileMap &tileMap, const std::vector<GenerationStep> &generations) {
+  if (!generations.empty() && !isCancelled(mCancel)) {
 
-    // initialise the RogueCave grid from the TileMap
-    PCG::RogueCave cave(mInfo.mCaveWidth, mInfo.mCaveHeight);
-    std::vector<std::vector<int>> &gridIn = cave.getGrid();
+    // initialise the CA grid from the TileMap
+    CellularAutomata cave(mInfo.mCaveWidth, mInfo.mCaveHeight,
+                          mParams.mGridLayout);
+    cave.setCancelToken(mCancel);
     for (int cy = 0; cy < mInfo.mCaveHeight; ++cy) {
       for (int cx = 0; cx < mInfo.mCaveWidth; ++cx) {
-        gridIn[cy][cx] = Cave::isWall(tileMap, cx, cy)
-                             ? PCG::RogueCave::TILE_WALL
-                             : PCG::RogueCave::TILE_FLOOR;
-        LOG_DEBUG_CONT(
-            ((gridIn[cy][cx] == PCG::RogueCave::TILE_FLOOR) ? ' ' : '#'));
+        cave.setWall(cx, cy, Cave::isWall(tileMap, cx, cy));
+        LOG_DEBUG_CONT((cave.isWall(cx, cy) ? '#' : ' '));
       }
       LOG_DEBUG(" ");
     }
 
     // run the cellular automata
-    for (const auto &gen : mParams.mGenerations) {
-      Util::IntRange b3(gen.b3_min, gen.b3_max);
-      Util::IntRange b5(gen.b5_min, gen.b5_max);
-      Util::IntRange s3(gen.s3_min, gen.s3_max);
-      Util::IntRange s5(gen.s5_min, gen.s5_max);
-      cave.addGeneration(b3, b5, s3, s5, gen.reps);
+    for (const auto &gen : generations) {
+      TraceScope trace("ca_step", mStats.mSteps.size());
+      mStats.mSteps.push_back(cave.runStep(gen, mParams.mDetectOscillation));
     }
-    std::vector<std::vector<int>> &gridOut = cave.generate();
+    if (isCancelled(mCancel))
+      return;
 
-    // Copy the RogueCave grid back to the TileMap
+    // Copy the CA grid back to the TileMap
     LOG_DEBUG("-----GRID OUT-----");
     for (int cy = 0; cy < mInfo.mCaveHeight; ++cy) {
       for (int cx = 0; cx < mInfo.mCaveWidth; ++cx) {
-        auto tile =
-            (gridOut[cy][cx] == PCG::RogueCave::TILE_WALL) ? WALL : FLOOR;
-        setCell(tileMap, cx, cy, tile);
-        LOG_DEBUG_CONT(
-            ((gridOut[cy][cx] == PCG::RogueCave::TILE_FLOOR) ? ' ' : '#'));
+        setCell(tileMap, cx, cy, cave.isWall(cx, cy) ? WALL : FLOOR);
+        LOG_DEBUG_CONT((cave.isWall(cx, cy) ? '#' : ' '));
       }
       LOG_DEBUG(" ");
     }
   }
 }
 
+//
+// Coarse to fine for big caves. A Cave mPyramidScale times smaller (same
+// params) does the noise and mGenerations, so its rules shape features
+// that are scale times bigger for scale^2 less work. Each coarse cell is
+// then copied to a scale x scale block here and mRefineGenerations tidy up
+// the blocky edges at full size. mStats.mSteps has the coarse steps then
+// the refine ones.
+//
+void Cave::runPyramid(TileMap &tileMap) {
+  TraceScope trace("pyramid");
+  const int scale = mParams.mPyramidScale;
+  CaveInfo coarseInfo = mInfo;
+  coarseInfo.mCaveWidth = (mInfo.mCaveWidth + scale - 1) / scale;
+  coarseInfo.mCaveHeight = (mInfo.mCaveHeight + scale - 1) / scale;
+  GenerationParams coarseParams = mParams;
+  coarseParams.mPyramidScale = 1;
+
+  Cave coarse(coarseInfo, coarseParams);
+  coarse.setCancelToken(mCancel);
+  TileMap coarseMap(coarseInfo.mCaveHeight + 2,
+                    std::vector<int>(coarseInfo.mCaveWidth + 2));
+  coarse.initialise(coarseMap);
+  coarse.runCellularAutomata(coarseMap, mParams.mGenerations);
+  mStats.mSteps = coarse.mStats.mSteps;
+  if (isCancelled(mCancel))
+    return;
+  LOG_INFO("PYRAMID: scale: " << scale << " coarse: " << coarseInfo.mCaveWidth
+                              << "x" << coarseInfo.mCaveHeight);
+
+  makeBorder(tileMap);
+  for (int cy = 0; cy < mInfo.mCaveHeight; ++cy) {
+    for (int cx = 0; cx < mInfo.mCaveWidth; ++cx) {
+      setCell(tileMap, cx, cy,
+              isWall(coarseMap, cx / scale, cy / scale) ? WALL : FLOOR);
+    }
+  }
+
+  if (mParams.mRefineGenerations.empty()) {
+    // Wall if most of the 3x3 is
+    const GenerationStep majority = {5, 9, 0, 25, 5, 9, 0, 25, 2};
+    runCellularAutomata(tileMap, {majority});
+  } else {
+    runCellularAutomata(tileMap, mParams.mRefineGenerations);
+  }
+}
+
+//
+// The fixUp rules only depend on the 8 neighbours being wall or not, so
+// they are run on the map packed into 64 bit words per row (bit set = wall)
+// and evaluated for 64 cells at a time with shifts and logic ops:
+//
+// - a wall that only touches another wall diagonally becomes floor
+//   e.g. NW set but N and W clear (the same for NE, SE, SW)
+// - a floor completely surrounded by walls becomes a wall
+//
+// Each pass works out all the changes from the map before the pass, the
+// same as collecting the walls/floors lists and applying them after.
+//
+namespace {
+struct BitRows {
+  int words;
+  std::vector<uint64_t> bits;
+
+  uint64_t *row(int y) { return &bits[y * words]; }
+
+  // Bit x of the word for the cell to the west/east of x
+  static uint64_t west(const uint64_t *r, int k) {
+    return (r[k] << 1) | ((k > 0) ? (r[k - 1] >> 63) : 0);
+  }
+  static uint64_t east(const uint64_t *r, int k, int words) {
+    return (r[k] >> 1) | ((k + 1 < words) ? (r[k + 1] << 63) : 0);
+  }
+};
+} // namespace
+
 void Cave::fixUp(TileMap &tileMap) {
-  std::vector<Vector2i> walls;
-  std::vector<Vector2i> floors;
-  for (int lp = 0; lp < 10; ++lp) {
-    for (int cy = 0; cy < mInfo.mCaveHeight; ++cy) {
-      for (int cx = 0; cx < mInfo.mCaveWidth; ++cx) {
-        int DIAG = 0;
-        int NSEW = 0;
-
-        if (Cave::isWall(tileMap, cx - 1, cy - 1))
-          DIAG += 1;
-        if (Cave::isWall(tileMap, cx, cy - 1))
-          NSEW += 1;
-        if (Cave::isWall(tileMap, cx + 1, cy - 1))
-          DIAG += 2;
-        if (Cave::isWall(tileMap, cx + 1, cy))
-          NSEW += 2;
-        if (Cave::isWall(tileMap, cx - 1, cy))
-          NSEW += 8;
-        if (Cave::isWall(tileMap, cx - 1, cy + 1))
-          DIAG += 8;
-        if (Cave::isWall(tileMap, cx, cy + 1))
-          NSEW += 4;
-        if (Cave::isWall(tileMap, cx + 1, cy + 1))
-          DIAG += 4;
-
-        LOG_DEBUG(cx << "," << cy << " D:" << DIAG << " N:" << NSEW
-                     << " W:" << Cave::isWall(tileMap, cx, cy));
-
-        if (Cave::isWall(tileMap, cx, cy)) {
-          if (((DIAG & 0b0001) != 0) && ((NSEW & 0b1001) == 0))
-            floors.push_back({cx, cy});
-          if (((DIAG & 0b0010) != 0) && ((NSEW & 0b0011) == 0))
-            floors.push_back({cx, cy});
-          if (((DIAG & 0b0100) != 0) && ((NSEW & 0b0110) == 0))
-            floors.push_back({cx, cy});
-          if (((DIAG & 0b1000) != 0) && ((NSEW & 0b1100) == 0))
-            floors.push_back({cx, cy});
-        } else if ((DIAG == 0b1111) && (NSEW == 0b1111)) {
-          walls.push_back({cx, cy});
-          LOG_DEBUG("ADDWALL: " << cx << "," << cy << " D:" << DIAG
-                                << " N:" << NSEW);
-        }
-      }
+  TraceScope trace("fixUp");
+  // Map coords (including the border ring)
+  const int mapW = mInfo.mCaveWidth + 2;
+  const int mapH = mInfo.mCaveHeight + 2;
+  BitRows grid;
+  grid.words = (mapW + 63) / 64;
+  grid.bits.assign(mapH * grid.words, 0);
+  for (int y = 0; y < mapH; ++y) {
+    uint64_t *r = grid.row(y);
+    for (int x = 0; x < mapW; ++x) {
+      if (tileMap[y][x] == WALL)
+        r[x >> 6] |= uint64_t(1) << (x & 63);
     }
-    LOG_DEBUG("WALLS: " << walls.size() << " FLOORS: " << floors.size());
-    if (walls.empty() && floors.empty())
+  }
+  // Only the cave cells (map x 1..W) can change
+  std::vector<uint64_t> inside(grid.words, 0);
+  for (int x = 1; x <= mInfo.mCaveWidth; ++x) {
+    inside[x >> 6] |= uint64_t(1) << (x & 63);
+  }
+
+  std::vector<uint64_t> next(grid.bits.size());
+  bool changed = false;
+  for (int lp = 0; lp < FIXUP_PASSES; ++lp) {
+    if (isCancelled(mCancel))
       return;
-    for (Vector2i corner : walls) {
-      LOG_DEBUG("WALL: " << corner.x << "," << corner.y);
-      setCell(tileMap, corner.x, corner.y, WALL);
+    uint64_t anyChange = 0;
+    next = grid.bits;
+    for (int y = 1; y <= mInfo.mCaveHeight; ++y) {
+      const uint64_t *rn = grid.row(y - 1);
+      const uint64_t *rc = grid.row(y);
+      const uint64_t *rs = grid.row(y + 1);
+      uint64_t *out = &next[y * grid.words];
+      for (int k = 0; k < grid.words; ++k) {
+        const uint64_t c = rc[k];
+        const uint64_t n = rn[k];
+        const uint64_t s = rs[k];
+        const uint64_t w = BitRows::west(rc, k);
+        const uint64_t e = BitRows::east(rc, k, grid.words);
+        const uint64_t nw = BitRows::west(rn, k);
+        const uint64_t ne = BitRows::east(rn, k, grid.words);
+        const uint64_t sw = BitRows::west(rs, k);
+        const uint64_t se = BitRows::east(rs, k, grid.words);
+
+        const uint64_t diagOnly = (nw & ~n & ~w) | (ne & ~n & ~e) |
+                                  (se & ~s & ~e) | (sw & ~s & ~w);
+        const uint64_t toFloor = c & diagOnly & inside[k];
+        const uint64_t toWall =
+            ~c & n & s & e & w & nw & ne & sw & se & inside[k];
+        out[k] = (c & ~toFloor) | toWall;
+        anyChange |= toFloor | toWall;
+      }
     }
-    for (Vector2i corner : floors) {
-      LOG_DEBUG("FLOOR: " << corner.x << "," << corner.y);
-      setCell(tileMap, corner.x, corner.y, FLOOR);
+    LOG_DEBUG("FIXUP PASS: " << lp << " changed: " << (anyChange != 0));
+    if (anyChange == 0)
+      break;
+    grid.bits.swap(next);
+    changed = true;
+  }
+  if (!changed)
+    return;
+
+  for (int cy = 0; cy < mInfo.mCaveHeight; ++cy) {
+    const uint64_t *r = grid.row(cy + 1);
+    for (int cx = 0; cx < mInfo.mCaveWidth; ++cx) {
+      int x = cx + 1;
+      bool wall = (r[x >> 6] >> (x & 63)) & 1;
+      setCell(tileMap, cx, cy, wall ? WALL : FLOOR);
     }
-    walls.clear();
-    floors.clear();
   }
 }
 
 std::pair<Vector2iIntMap, IntVectorOfVector2iMap>
 Cave::findRooms(TileMap &tileMap) {
-  Algo::DisjointSets<Vector2i> floors;
-  static const std::vector<Vector2i> directions = {
-      {0, 1}, {1, 0}, {0, -1}, {-1, 0}};
+  TraceScope trace("findRooms");
+  const int W = mInfo.mCaveWidth;
+  const int H = mInfo.mCaveHeight;
   LOG_DEBUG("----FIND ROOMS----");
 
-  for (int cx = 0; cx < mInfo.mCaveWidth; ++cx) {
-    for (int cy = 0; cy < mInfo.mCaveHeight; ++cy) {
-      if (isFloor(tileMap, cx, cy)) {
-        floors.addElement({cx, cy});
-        LOG_DEBUG("FLOOR: " << cx << "," << cy);
-      }
-    }
-  }
-
-  for (int cx = 0; cx < mInfo.mCaveWidth; ++cx) {
-    for (int cy = 0; cy < mInfo.mCaveHeight; ++cy) {
-      if (isFloor(tileMap, cx, cy)) {
-        for (const Vector2i &dir : directions) {
-          int nx = cx + dir.x;
-          int ny = cy + dir.y;
-          if ((nx >= 0 && nx < mInfo.mCaveWidth) &&
-              (ny >= 0 && ny < mInfo.mCaveHeight)) {
-            if (isFloor(tileMap, nx, ny)) {
-              int i1 = floors.findSet({cx, cy});
-              int i2 = floors.findSet({nx, ny});
-              LOG_DEBUG("JOIN: " << cx << "," << cy << " nxy:" << nx << ","
-                                 << ny << " " << i1 << "->" << i2);
-              floors.joinSets(i1, i2);
-            }
-          }
-        }
-      }
+  std::vector<uint8_t> floors(W * H);
+  for (int cy = 0; cy < H; ++cy) {
+    for (int cx = 0; cx < W; ++cx) {
+      floors[cy * W + cx] = isFloor(tileMap, cx, cy) ? 1 : 0;
     }
   }
+  std::vector<int> labels;
+  RoomLabeler::label(floors, W, H, mParams.mThreads, labels, mCancel);
 
   Vector2iIntMap grid_to_set;
   IntVectorOfVector2iMap set_to_cells;
 
-  for (int cx = 0; cx < mInfo.mCaveWidth; ++cx) {
-    for (int cy = 0; cy < mInfo.mCaveHeight; ++cy) {
-      if (isFloor(tileMap, cx, cy)) {
+  for (int cy = 0; cy < H; ++cy) {
+    for (int cx = 0; cx < W; ++cx) {
+      int rootId = labels[cy * W + cx];
+      if (rootId >= 0) {
         Vector2i current = {cx, cy};
-        int rootId = floors.findSet(current);
         grid_to_set[current] = rootId;
         set_to_cells[rootId].push_back(current);
         LOG_DEBUG("xy: " << cx << "," << cy << " <=> " << rootId);
@@ -233,9 +482,49 @@ Cave::findRooms(TileMap &tileMap) {
   return std::pair(grid_to_set, set_to_cells);
 }
 
-void Cave::joinRooms(
+//
+// Fill in the rooms smaller than mMinRoomSize so they don't get border
+// walls and tunnels. The largest room is always kept so there is a cave.
+//
+void Cave::cullSmallRooms(
+    TileMap &tileMap,
+    std::pair<Vector2iIntMap, IntVectorOfVector2iMap> &floorMaps) {
+  if (mParams.mMinRoomSize <= 1 || floorMaps.second.empty())
+    return;
+  Vector2iIntMap &floorToRoomMap = floorMaps.first;
+  IntVectorOfVector2iMap &roomsMap = floorMaps.second;
+
+  int largestRoom = roomsMap.begin()->first;
+  size_t largestSize = 0;
+  for (const auto &[roomID, tiles] : roomsMap) {
+    if (tiles.size() > largestSize ||
+        (tiles.size() == largestSize && roomID < largestRoom)) {
+      largestSize = tiles.size();
+      largestRoom = roomID;
+    }
+  }
+
+  size_t culled = 0;
+  for (auto it = roomsMap.begin(); it != roomsMap.end();) {
+    if (it->first != largestRoom &&
+        it->second.size() < (size_t)mParams.mMinRoomSize) {
+      for (const Vector2i &tile : it->second) {
+        setCell(tileMap, tile.x, tile.y, WALL);
+        floorToRoomMap.erase(tile);
+      }
+      it = roomsMap.erase(it);
+      ++culled;
+    } else {
+      ++it;
+    }
+  }
+  LOG_INFO("CULLED ROOMS: " << culled << " left: " << roomsMap.size());
+}
+
+std::vector<Cave::BorderWall> Cave::joinRooms(
     TileMap &tileMap,
     std::pair<Vector2iIntMap, IntVectorOfVector2iMap> floorMaps) {
+  TraceScope trace("joinRooms");
   std::vector<Cave::BorderWall> borderWalls =
       detectBorderWalls(tileMap, floorMaps);
   IntVectorOfVector2iMap roomToFloorsMap = floorMaps.second;
@@ -281,6 +570,7 @@ void Cave::joinRooms(
     }
     LOG_DEBUG("");
   }
+  return mst;
 }
 
 std::vector<Cave::BorderWall> Cave::detectBorderWalls(
@@ -356,15 +646,19 @@ std::vector<Cave::BorderWall> Cave::detectBorderWalls(
           }
 
           if (adjacentRooms.size() == 2) {
-            auto it = adjacentRooms.begin();
-            int room1 = *it++;
-            int room2 = *it;
+            int otherRoomID = floorToRoomMap.find({cx, cy})->second;
             LOG_DEBUG(id << "=> BWALL: xy:" << cx << "," << cy << " tile: "
-                         << tile.x << "," << tile.y << " r1: " << room1
-                         << " r2: " << room2 << " thick: " << thickness
+                         << tile.x << "," << tile.y << " r1: " << roomID
+                         << " r2: " << otherRoomID << " thick: " << thickness
                          << " wallDir: " << dir.x << "," << dir.y);
-            borderWalls.push_back(
-                {tile, {cx, cy}, dir, room1, room2, thickness});
+            // Always from the top/left end (see wallBefore)
+            if (dir.x < 0 || dir.y < 0) {
+              borderWalls.push_back({{cx, cy}, tile, {-dir.x, -dir.y},
+                                     otherRoomID, roomID, thickness});
+            } else {
+              borderWalls.push_back(
+                  {tile, {cx, cy}, dir, roomID, otherRoomID, thickness});
+            }
           }
         }
       }
@@ -373,6 +667,17 @@ std::vector<Cave::BorderWall> Cave::detectBorderWalls(
   return borderWalls;
 }
 
+bool Cave::wallBefore(const BorderWall &a, const BorderWall &b) {
+  if (a.thickness != b.thickness)
+    return a.thickness < b.thickness;
+  if (a.floor1.y != b.floor1.y)
+    return a.floor1.y < b.floor1.y;
+  if (a.floor1.x != b.floor1.x)
+    return a.floor1.x < b.floor1.x;
+  // Along the row before down the column
+  return a.dir.x > b.dir.x;
+}
+
 std::vector<Cave::BorderWall>
 Cave::findMST_Kruskal(std::vector<Cave::BorderWall> &borderWalls,
                       std::vector<int> roomIds) {
@@ -384,10 +689,7 @@ Cave::findMST_Kruskal(std::vector<Cave::BorderWall> &borderWalls,
     dsu.addElement(i);
   }
 
-  std::sort(borderWalls.begin(), borderWalls.end(),
-            [](const BorderWall &a, const BorderWall &b) {
-              return a.thickness < b.thickness;
-            });
+  std::stable_sort(borderWalls.begin(), borderWalls.end(), &wallBefore);
   LOG_INFO("=== findMST: " << borderWalls.size() << " rooms: " << numRooms);
 
   for (const BorderWall &wall : borderWalls) {
@@ -411,15 +713,83 @@ Cave::findMST_Kruskal(std::vector<Cave::BorderWall> &borderWalls,
   return mst;
 }
 
+//
+// The RoomLabeler ids are already in raster order of each room's first
+// cell, but culling leaves gaps, so renumber the rooms left 0 .. count - 1
+// (same order) and gather the per room info and the MST tunnels.
+//
+void Cave::buildRoomGraph(
+    const std::pair<Vector2iIntMap, IntVectorOfVector2iMap> &floorMaps,
+    const std::vector<BorderWall> &mst, RoomGraph &roomGraph) {
+  const Vector2iIntMap &floorToRoomMap = floorMaps.first;
+  const int W = mInfo.mCaveWidth;
+  const int H = mInfo.mCaveHeight;
+
+  roomGraph.clear();
+  roomGraph.mWidth = W;
+  roomGraph.mHeight = H;
+  roomGraph.mLabels.assign(W * H, -1);
+
+  std::unordered_map<int, int> labelToId;
+  std::vector<double> sumX;
+  std::vector<double> sumY;
+  for (int cy = 0; cy < H; ++cy) {
+    for (int cx = 0; cx < W; ++cx) {
+      auto it = floorToRoomMap.find({cx, cy});
+      if (it == floorToRoomMap.end())
+        continue;
+      auto [idIt, isNew] =
+          labelToId.emplace(it->second, (int)roomGraph.mRooms.size());
+      int id = idIt->second;
+      if (isNew) {
+        RoomInfo room;
+        room.mId = id;
+        room.mMin = {cx, cy};
+        room.mMax = {cx, cy};
+        roomGraph.mRooms.push_back(room);
+        sumX.push_back(0);
+        sumY.push_back(0);
+      }
+      RoomInfo &room = roomGraph.mRooms[id];
+      room.mCellCount++;
+      room.mMin.x = std::min(room.mMin.x, cx);
+      room.mMin.y = std::min(room.mMin.y, cy);
+      room.mMax.x = std::max(room.mMax.x, cx);
+      room.mMax.y = std::max(room.mMax.y, cy);
+      sumX[id] += cx;
+      sumY[id] += cy;
+      roomGraph.mLabels[cy * W + cx] = id;
+    }
+  }
+  for (RoomInfo &room : roomGraph.mRooms) {
+    room.mCentroidX = (float)(sumX[room.mId] / room.mCellCount);
+    room.mCentroidY = (float)(sumY[room.mId] / room.mCellCount);
+  }
+
+  // The tunnel runs from the cell after floor1 to the cell before floor2
+  for (const BorderWall &wall : mst) {
+    RoomEdge edge;
+    edge.mRoom1 = roomGraph.mLabels[wall.floor1.y * W + wall.floor1.x];
+    edge.mRoom2 = roomGraph.mLabels[wall.floor2.y * W + wall.floor2.x];
+    edge.mStart = {wall.floor1.x + wall.dir.x, wall.floor1.y + wall.dir.y};
+    edge.mDir = wall.dir;
+    edge.mThickness = wall.thickness;
+    roomGraph.mEdges.push_back(edge);
+  }
+  LOG_INFO("ROOM GRAPH: rooms: " << roomGraph.mRooms.size()
+                                 << " edges: " << roomGraph.mEdges.size());
+}
+
 void Cave::smooth(TileMap &tileMap) {
-  CaveSmoother smoother(tileMap, mInfo);
+  TraceScope trace("smooth");
+  CaveSmoother smoother(tileMap, mInfo, mParams.mThreads, mCancel);
   smoother.smoothEdges();
 }
 
 bool Cave::isTile(const TileMap &tileMap, int cx, int cy, int tile) {
   Vector2i mapPos = getMapPos(cx, cy);
-  if (mapPos.x >= 0 && mapPos.x < tileMap.size() && mapPos.y >= 0 &&
-      mapPos.y < tileMap[0].size()) {
+  if (mapPos.y >= 0 && mapPos.y < tileMap.size() && mapPos.x >= 0 &&
+      mapPos.x < tileMap[0].size()) {
     return tileMap[mapPos.y][mapPos.x] == tile;
   }
   return false;
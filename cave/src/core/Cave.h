@@ -1,13 +1,21 @@
 #ifndef CAVE_H
 #define CAVE_H
 
+#include "CancelToken.h"
 #include "CaveInfo.h"
 #include "GenerationParams.h"
+#include "GenerationStats.h"
+#include "RoomGraph.h"
 #include "TileTypes.h"
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <unordered_map>
 #include <vector>
 
+namespace RNG {
+class RandSimple;
+}
 
 namespace Cave {
 
@@ -28,22 +36,70 @@ using Vector2iIntMap =
 using IntVectorOfVector2iMap = std::unordered_map<int, std::vector<Vector2i>>;
 
 class Cave {
+  // Does the whole cave a band at a time with the private stages below
+  friend class CaveStreamer;
+
   CaveInfo mInfo;
   GenerationParams mParams;
+  GenerationStats mStats;
+  const CancelToken *mCancel = nullptr;
+  // noiseRow's x for each column, made on its first row
+  std::vector<double> mNoiseXs;
 
 public:
   Cave(CaveInfo &info, const GenerationParams &params);
   ~Cave();
 
-  TileMap generate();
+  // If pRoomGraph is given it is filled with the rooms and tunnels.
+  // Returns an empty TileMap if the cave fails the mParams.mAccept criteria
+  // (see getStats().mRejection for why).
+  TileMap generate(RoomGraph *pRoomGraph = nullptr);
+  // Stats of the last generate
+  const GenerationStats &getStats() const { return mStats; }
+  bool isRejected() const { return mStats.mRejection != ACCEPTED; }
+  // generate stops soon after the token is cancelled (mRejection is then
+  // CANCELLED). The token must outlive the generate.
+  void setCancelToken(const CancelToken *token) { mCancel = token; }
+
+  //
+  // generate in two halves, so params that share the noise and the start
+  // of mGenerations can share that work. Full resolution only
+  // (mPyramidScale is ignored).
+  //
+  // runSteps returns the cave cells (row major, 1 = wall) after the noise
+  // and the first steps of mGenerations, carrying on from the cells after
+  // the first fromSteps if from is given. The StepStats of the steps run
+  // are added to getStats().mSteps and their time (and the noise's) to
+  // mStageMs. Empty if cancelled.
+  std::vector<uint8_t> runSteps(int steps,
+                                const std::vector<uint8_t> *from = nullptr,
+                                int fromSteps = 0);
+  // The rest of generate, from the cells after all of mGenerations. The
+  // same as generate for the same params.
+  TileMap generateFrom(const std::vector<uint8_t> &cells,
+                       RoomGraph *pRoomGraph = nullptr);
 
 private:
+  // Most fixUp passes before giving up on it settling
+  static const int FIXUP_PASSES = 10;
+
   void initialise(TileMap &tileMap);
-  void runCellularAutomata(TileMap &tileMap);
+  void noiseRow(int cy, RNG::RandSimple &simple, std::vector<uint8_t> &walls);
+  void makeBorder(TileMap &tileMap);
+  void runCellularAutomata(TileMap &tileMap,
+                           const std::vector<GenerationStep> &generations);
+  void runPyramid(TileMap &tileMap);
+  void endStage(Stage stage, std::chrono::steady_clock::time_point &lap);
+  // endStage adding to the stage's time so far
+  void addStage(Stage stage, std::chrono::steady_clock::time_point &lap);
+  TileMap finish(TileMap &tileMap, RoomGraph *pRoomGraph,
+                 std::chrono::steady_clock::time_point &lap);
   void fixUp(TileMap &tileMap);
+  float floorRatio(const TileMap &tileMap);
+  TileMap reject(Rejection rejection);
   std::pair<Vector2iIntMap, IntVectorOfVector2iMap> findRooms(TileMap &tileMap);
-  void joinRooms(TileMap &tileMap,
-                 std::pair<Vector2iIntMap, IntVectorOfVector2iMap> floorMaps);
+  void cullSmallRooms(TileMap &tileMap,
+                      std::pair<Vector2iIntMap, IntVectorOfVector2iMap> &floorMaps);
   void smooth(TileMap &tileMap);
 
   struct BorderWall {
@@ -54,6 +110,17 @@ private:
     int room2;
     int thickness;
   };
+  // The order the MST tries the walls in: thinnest first, then by where
+  // they are, so it picks the same ones however the rooms are numbered
+  // or the walls found. floor1 is the end that comes first in raster
+  // order, so dir is (1,0) or (0,1).
+  static bool wallBefore(const BorderWall &a, const BorderWall &b);
+  std::vector<BorderWall>
+  joinRooms(TileMap &tileMap,
+            std::pair<Vector2iIntMap, IntVectorOfVector2iMap> floorMaps);
+  void buildRoomGraph(
+      const std::pair<Vector2iIntMap, IntVectorOfVector2iMap> &floorMaps,
+      const std::vector<BorderWall> &mst, RoomGraph &roomGraph);
   std::vector<BorderWall> detectBorderWalls(
       TileMap &tileMap,
       std::pair<Vector2iIntMap, IntVectorOfVector2iMap> floorMaps);
@@ -0,0 +1,312 @@
+#include "CaveApi.h"
+#include "Cave.h"
+#include "CancelToken.h"
+#include "CaveInfo.h"
+#include "CaveStreamer.h"
+#include "GenerationParams.h"
+#include "GenerationStats.h"
+#include "RoomGraph.h"
+#include "RowSink.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#include "Debug.h"
+
+struct CaveContext {
+  Cave::CaveInfo mInfo;
+  Cave::GenerationParams mParams;
+  bool mRoomGraphEnabled = false;
+  Cave::CancelToken mCancel;
+  Cave::GenerationStats mStats;
+  Cave::RoomGraph mRoomGraph;
+};
+
+namespace {
+
+bool toStep(const int *values, int count, Cave::GenerationStep &step) {
+  if (!values || (count != 9 && count != 14))
+    return false;
+  int v[14] = {};
+  std::copy(values, values + count, v);
+  step = {v[0], v[1], v[2],  v[3],  v[4],  v[5],  v[6],
+          v[7], v[8], v[9], v[10], v[11], v[12], v[13]};
+  return true;
+}
+
+// A byte (TileName) per tile, straight into the caller's buffer
+class BufferRowSink : public Cave::RowSink {
+public:
+  BufferRowSink(uint8_t *buffer, size_t width)
+      : mBuffer(buffer), mWidth(width) {}
+
+  void writeRow(int y, const std::vector<int> &row) override {
+    uint8_t *out = mBuffer + y * mWidth;
+    for (size_t x = 0; x < mWidth; ++x) {
+      out[x] = (uint8_t)row[x];
+    }
+  }
+
+private:
+  uint8_t *mBuffer;
+  size_t mWidth;
+};
+
+// Rows a band for the CaveStreamer
+const int BAND_ROWS = 256;
+
+} // namespace
+
+extern "C" {
+
+int cave_api_version(void) { return CAVE_API_VERSION; }
+
+CaveContext *cave_create(void) { return new (std::nothrow) CaveContext; }
+
+void cave_destroy(CaveContext *ctx) { delete ctx; }
+
+int cave_set_size(CaveContext *ctx, int width, int height) {
+  if (!ctx || width < 1 || height < 1)
+    return CAVE_INVALID_ARGUMENT;
+  ctx->mInfo.mCaveWidth = width;
+  ctx->mInfo.mCaveHeight = height;
+  return CAVE_OK;
+}
+
+int cave_set_border(CaveContext *ctx, int width, int height) {
+  if (!ctx || width < 0 || height < 0)
+    return CAVE_INVALID_ARGUMENT;
+  ctx->mInfo.mBorderWidth = width;
+  ctx->mInfo.mBorderHeight = height;
+  return CAVE_OK;
+}
+
+int cave_set_cell_size(CaveContext *ctx, int width, int height) {
+  if (!ctx || width < 1 || height < 1)
+    return CAVE_INVALID_ARGUMENT;
+  ctx->mInfo.mCellWidth = width;
+  ctx->mInfo.mCellHeight = height;
+  return CAVE_OK;
+}
+
+void cave_set_seed(CaveContext *ctx, int seed) {
+  if (ctx)
+    ctx->mParams.seed = seed;
+}
+
+void cave_set_noise(CaveContext *ctx, int octaves, int perlin, float freq,
+                    float amp) {
+  if (!ctx)
+    return;
+  ctx->mParams.mOctaves = octaves;
+  ctx->mParams.mPerlin = perlin != 0;
+  ctx->mParams.mFreq = freq;
+  ctx->mParams.mAmp = amp;
+}
+
+void cave_set_wall_chance(CaveContext *ctx, float wallChance) {
+  if (ctx)
+    ctx->mParams.mWallChance = wallChance;
+}
+
+int cave_add_step(CaveContext *ctx, const int *values, int count) {
+  Cave::GenerationStep step;
+  if (!ctx || !toStep(values, count, step))
+    return CAVE_INVALID_ARGUMENT;
+  try {
+    ctx->mParams.mGenerations.push_back(step);
+  } catch (const std::bad_alloc &) {
+    return CAVE_ERROR;
+  }
+  return CAVE_OK;
+}
+
+void cave_clear_steps(CaveContext *ctx) {
+  if (ctx)
+    ctx->mParams.mGenerations.clear();
+}
+
+void cave_set_min_room_size(CaveContext *ctx, int cells) {
+  if (ctx)
+    ctx->mParams.mMinRoomSize = cells;
+}
+
+int cave_set_pyramid(CaveContext *ctx, int scale) {
+  if (!ctx || scale < 1)
+    return CAVE_INVALID_ARGUMENT;
+  ctx->mParams.mPyramidScale = scale;
+  return CAVE_OK;
+}
+
+int cave_add_refine_step(CaveContext *ctx, const int *values, int count) {
+  Cave::GenerationStep step;
+  if (!ctx || !toStep(values, count, step))
+    return CAVE_INVALID_ARGUMENT;
+  try {
+    ctx->mParams.mRefineGenerations.push_back(step);
+  } catch (const std::bad_alloc &) {
+    return CAVE_ERROR;
+  }
+  return CAVE_OK;
+}
+
+void cave_clear_refine_steps(CaveContext *ctx) {
+  if (ctx)
+    ctx->mParams.mRefineGenerations.clear();
+}
+
+void cave_set_acceptance(CaveContext *ctx, float minFloorRatio,
+                         float maxFloorRatio, int minRooms, int maxRooms,
+                         int maxTunnels) {
+  if (!ctx)
+    return;
+  Cave::AcceptanceCriteria &accept = ctx->mParams.mAccept;
+  accept.mMinFloorRatio = minFloorRatio;
+  accept.mMaxFloorRatio = maxFloorRatio;
+  accept.mMinRooms = minRooms;
+  accept.mMaxRooms = maxRooms;
+  accept.mMaxTunnels = maxTunnels;
+}
+
+void cave_set_threads(CaveContext *ctx, int threads) {
+  if (ctx)
+    ctx->mParams.mThreads = threads;
+}
+
+void cave_set_room_graph(CaveContext *ctx, int enabled) {
+  if (ctx)
+    ctx->mRoomGraphEnabled = enabled != 0;
+}
+
+void cave_get_map_size(const CaveContext *ctx, int *width, int *height) {
+  if (width)
+    *width = ctx ? ctx->mInfo.mCaveWidth + 2 : 0;
+  if (height)
+    *height = ctx ? ctx->mInfo.mCaveHeight + 2 : 0;
+}
+
+//
+// Streamed a band at a time straight into buffer unless the whole map is
+// needed (the room graph or the pyramid), then it is made with
+// Cave::generate and each row freed once it is in buffer.
+//
+int cave_generate(CaveContext *ctx, uint8_t *buffer, size_t size) {
+  if (!ctx)
+    return CAVE_INVALID_ARGUMENT;
+  const size_t width = ctx->mInfo.mCaveWidth + 2;
+  const size_t height = ctx->mInfo.mCaveHeight + 2;
+  if (!buffer || size < width * height)
+    return CAVE_BUFFER_TOO_SMALL;
+
+  ctx->mStats.clear();
+  ctx->mRoomGraph.clear();
+  ctx->mCancel.reset();
+  BufferRowSink sink(buffer, width);
+  try {
+    if (!ctx->mRoomGraphEnabled && ctx->mParams.mPyramidScale <= 1) {
+      Cave::CaveStreamer streamer(ctx->mInfo, ctx->mParams, BAND_ROWS);
+      streamer.setCancelToken(&ctx->mCancel);
+      streamer.generate(sink);
+      ctx->mStats = streamer.getStats();
+    } else {
+      Cave::Cave cave(ctx->mInfo, ctx->mParams);
+      cave.setCancelToken(&ctx->mCancel);
+      Cave::TileMap tileMap = cave.generate(
+          ctx->mRoomGraphEnabled ? &ctx->mRoomGraph : nullptr);
+      ctx->mStats = cave.getStats();
+      if (ctx->mStats.mRejection == Cave::ACCEPTED) {
+        for (size_t y = 0; y < height; ++y) {
+          sink.writeRow(y, tileMap[y]);
+          std::vector<int>().swap(tileMap[y]);
+        }
+      }
+    }
+  } catch (const std::bad_alloc &) {
+    LOG_INFO("CAVE API: out of memory generating " << width << "x" << height);
+    ctx->mRoomGraph.clear();
+    return CAVE_ERROR;
+  }
+  if (ctx->mStats.mRejection != Cave::ACCEPTED) {
+    ctx->mRoomGraph.clear();
+    return (ctx->mStats.mRejection == Cave::FAILED) ? CAVE_ERROR
+                                                    : CAVE_REJECTED;
+  }
+  return CAVE_OK;
+}
+
+void cave_cancel(CaveContext *ctx) {
+  if (ctx)
+    ctx->mCancel.cancel();
+}
+
+int cave_get_rejection(const CaveContext *ctx) {
+  return ctx ? ctx->mStats.mRejection : CAVE_ACCEPTED;
+}
+
+float cave_get_floor_ratio(const CaveContext *ctx) {
+  return ctx ? ctx->mStats.mFloorRatio : 0;
+}
+
+int cave_get_tunnel_count(const CaveContext *ctx) {
+  return ctx ? ctx->mStats.mTunnelCount : 0;
+}
+
+float cave_get_stage_ms(const CaveContext *ctx, int stage) {
+  if (!ctx || stage < 0 || stage >= Cave::STAGE_COUNT)
+    return 0;
+  return ctx->mStats.mStageMs[stage];
+}
+
+int cave_get_room_count(const CaveContext *ctx) {
+  return ctx ? ctx->mStats.mRoomCount : 0;
+}
+
+int cave_get_room(const CaveContext *ctx, int index, CaveRoom *room) {
+  if (!ctx || !room || index < 0 ||
+      index >= (int)ctx->mRoomGraph.mRooms.size())
+    return CAVE_INVALID_ARGUMENT;
+  const Cave::RoomInfo &info = ctx->mRoomGraph.mRooms[index];
+  room->id = info.mId;
+  room->cell_count = info.mCellCount;
+  room->min_x = info.mMin.x;
+  room->min_y = info.mMin.y;
+  room->max_x = info.mMax.x;
+  room->max_y = info.mMax.y;
+  room->centroid_x = info.mCentroidX;
+  room->centroid_y = info.mCentroidY;
+  return CAVE_OK;
+}
+
+int cave_get_edge_count(const CaveContext *ctx) {
+  return ctx ? ctx->mRoomGraph.mEdges.size() : 0;
+}
+
+int cave_get_edge(const CaveContext *ctx, int index, CaveEdge *edge) {
+  if (!ctx || !edge || index < 0 ||
+      index >= (int)ctx->mRoomGraph.mEdges.size())
+    return CAVE_INVALID_ARGUMENT;
+  const Cave::RoomEdge &info = ctx->mRoomGraph.mEdges[index];
+  edge->room1 = info.mRoom1;
+  edge->room2 = info.mRoom2;
+  edge->start_x = info.mStart.x;
+  edge->start_y = info.mStart.y;
+  edge->dir_x = info.mDir.x;
+  edge->dir_y = info.mDir.y;
+  edge->thickness = info.mThickness;
+  return CAVE_OK;
+}
+
+int cave_get_room_labels(const CaveContext *ctx, int32_t *labels,
+                         size_t count) {
+  if (!ctx)
+    return CAVE_INVALID_ARGUMENT;
+  const std::vector<int> &source = ctx->mRoomGraph.mLabels;
+  if (source.empty())
+    return CAVE_INVALID_ARGUMENT;
+  if (!labels || count < source.size())
+    return CAVE_BUFFER_TOO_SMALL;
+  std::copy(source.begin(), source.end(), labels);
+  return CAVE_OK;
+}
+
+} // extern "C"
@@ -0,0 +1,175 @@
+#ifndef CAVE_API_H
+#define CAVE_API_H
+
+/*
+ * C interface to the generator, for embedding it without Godot or the C++
+ * classes (e.g. a dedicated server or other languages).
+ *
+ * A CaveContext holds the settings and the results of its last generate.
+ * Settings default as in CaveInfo / GenerationParams. The map is written
+ * straight into a buffer the caller owns, a byte (TileName) per tile row
+ * by row, the same layout as FileRowSink without the header. Its size is
+ * the TileMap's, so the cave plus a tile of border each side.
+ *
+ * A context must only be used by one thread at a time, apart from
+ * cave_cancel. Nothing here throws; running out of memory gives CAVE_ERROR.
+ * A NULL ctx gives CAVE_INVALID_ARGUMENT (or 0, or does nothing).
+ *
+ * Only functions are added in later versions, the structs don't change.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+#ifdef CAVE_BUILD
+#define CAVE_API __declspec(dllexport)
+#else
+#define CAVE_API __declspec(dllimport)
+#endif
+#elif defined(__GNUC__)
+#define CAVE_API __attribute__((visibility("default")))
+#else
+#define CAVE_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAVE_API_VERSION 1
+
+/* Results */
+#define CAVE_OK 0
+/* Failed the acceptance criteria, see cave_get_rejection */
+#define CAVE_REJECTED 1
+#define CAVE_BUFFER_TOO_SMALL 2
+#define CAVE_INVALID_ARGUMENT 3
+#define CAVE_ERROR 4
+
+/* cave_get_rejection (as Cave::Rejection) */
+#define CAVE_ACCEPTED 0
+#define CAVE_REJECT_FLOOR_RATIO 1
+#define CAVE_REJECT_ROOM_COUNT 2
+#define CAVE_REJECT_TUNNEL_COUNT 3
+#define CAVE_CANCELLED 4
+/* With CAVE_ERROR (see the log) */
+#define CAVE_FAILED 5
+
+/* Stages for cave_get_stage_ms (as Cave::Stage) */
+#define CAVE_STAGE_NOISE 0
+#define CAVE_STAGE_CA 1
+#define CAVE_STAGE_FIXUP 2
+#define CAVE_STAGE_ROOMS 3
+#define CAVE_STAGE_JOIN 4
+#define CAVE_STAGE_SMOOTH 5
+#define CAVE_STAGE_COUNT 6
+
+typedef struct CaveContext CaveContext;
+
+/* Positions are cave cells, (0,0) being the first cell inside the border */
+typedef struct CaveRoom {
+  int32_t id;
+  int32_t cell_count;
+  /* Inclusive bounding box */
+  int32_t min_x, min_y;
+  int32_t max_x, max_y;
+  float centroid_x, centroid_y;
+} CaveRoom;
+
+/* A tunnel of thickness cells from start stepping by dir */
+typedef struct CaveEdge {
+  int32_t room1, room2;
+  int32_t start_x, start_y;
+  int32_t dir_x, dir_y;
+  int32_t thickness;
+} CaveEdge;
+
+/* CAVE_API_VERSION the library was built with */
+CAVE_API int cave_api_version(void);
+
+/* NULL if out of memory */
+CAVE_API CaveContext *cave_create(void);
+CAVE_API void cave_destroy(CaveContext *ctx);
+
+/* Settings, CAVE_INVALID_ARGUMENT if out of range */
+CAVE_API int cave_set_size(CaveContext *ctx, int width, int height);
+CAVE_API int cave_set_border(CaveContext *ctx, int width, int height);
+CAVE_API int cave_set_cell_size(CaveContext *ctx, int width, int height);
+CAVE_API void cave_set_seed(CaveContext *ctx, int seed);
+CAVE_API void cave_set_noise(CaveContext *ctx, int octaves, int perlin,
+                             float freq, float amp);
+CAVE_API void cave_set_wall_chance(CaveContext *ctx, float wallChance);
+/*
+ * A GenerationStep as in set_generations: 9 values (b3 min max, b5 min max,
+ * s3 min max, s5 min max, reps) or 14 (then radius, bn min max, sn min max)
+ */
+CAVE_API int cave_add_step(CaveContext *ctx, const int *values, int count);
+CAVE_API void cave_clear_steps(CaveContext *ctx);
+CAVE_API void cave_set_min_room_size(CaveContext *ctx, int cells);
+/* Coarse to fine (GenerationParams::mPyramidScale), 1 = off */
+CAVE_API int cave_set_pyramid(CaveContext *ctx, int scale);
+/* Steps for the full size refine, in the same form as cave_add_step */
+CAVE_API int cave_add_refine_step(CaveContext *ctx, const int *values,
+                                  int count);
+CAVE_API void cave_clear_refine_steps(CaveContext *ctx);
+/* A max < 0 is no limit */
+CAVE_API void cave_set_acceptance(CaveContext *ctx, float minFloorRatio,
+                                  float maxFloorRatio, int minRooms,
+                                  int maxRooms, int maxTunnels);
+/* 0 = all cores, 1 = serial */
+CAVE_API void cave_set_threads(CaveContext *ctx, int threads);
+/* Keep the rooms and tunnels for cave_get_room etc. (off by default) */
+CAVE_API void cave_set_room_graph(CaveContext *ctx, int enabled);
+
+/* Size of the buffer cave_generate needs */
+CAVE_API void cave_get_map_size(const CaveContext *ctx, int *width,
+                                int *height);
+
+/*
+ * Generates into buffer (at least width * height bytes of
+ * cave_get_map_size). Only CAVE_OK leaves a map in it: a rejected cave
+ * doesn't touch it, a CAVE_ERROR may have written part of it.
+ *
+ * The map goes into buffer a band of rows at a time (Cave::CaveStreamer),
+ * so the only full size memory is the buffer. That isn't possible with
+ * cave_set_room_graph or cave_set_pyramid, which need the whole map; then
+ * it is generated whole (an int per tile) and copied in. Either way it is
+ * the same map (and the same as GDCave's for the same settings and seed);
+ * only streaming doesn't give the per stage times.
+ */
+CAVE_API int cave_generate(CaveContext *ctx, uint8_t *buffer, size_t size);
+/*
+ * From any thread, the running generate soon stops with CAVE_REJECTED
+ * (rejection CAVE_CANCELLED). Has no effect if none is running.
+ */
+CAVE_API void cave_cancel(CaveContext *ctx);
+
+/* Of the last generate */
+CAVE_API int cave_get_rejection(const CaveContext *ctx);
+CAVE_API float cave_get_floor_ratio(const CaveContext *ctx);
+CAVE_API int cave_get_tunnel_count(const CaveContext *ctx);
+/* 0 when streamed */
+CAVE_API float cave_get_stage_ms(const CaveContext *ctx, int stage);
+/* Rooms found before joining (with or without the room graph) */
+CAVE_API int cave_get_room_count(const CaveContext *ctx);
+
+/*
+ * The room graph of the last accepted generate, if cave_set_room_graph.
+ * Rooms are 0 .. cave_get_room_count - 1.
+ */
+CAVE_API int cave_get_room(const CaveContext *ctx, int index, CaveRoom *room);
+CAVE_API int cave_get_edge_count(const CaveContext *ctx);
+CAVE_API int cave_get_edge(const CaveContext *ctx, int index, CaveEdge *edge);
+/*
+ * The room id per cave cell (row major, -1 if not a room), into labels of
+ * at least cave width * height entries
+ */
+CAVE_API int cave_get_room_labels(const CaveContext *ctx, int32_t *labels,
+                                  size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,391 @@
+#include "CaveCache.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+#include "Debug.h"
+
+namespace Cave {
+
+namespace {
+
+const char MAGIC[4] = {'G', 'D', 'C', 'V'};
+
+// FNV-1a
+struct Hasher {
+  uint64_t mHash = 14695981039346656037ull;
+
+  void bytes(const void *data, size_t size) {
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i) {
+      mHash = (mHash ^ p[i]) * 1099511628211ull;
+    }
+  }
+  void i32(int32_t v) { bytes(&v, sizeof(v)); }
+  void f32(float v) { bytes(&v, sizeof(v)); }
+  void steps(const std::vector<GenerationStep> &steps) {
+    i32(steps.size());
+    for (const GenerationStep &s : steps) {
+      for (int v : {s.b3_min, s.b3_max, s.b5_min, s.b5_max, s.s3_min, s.s3_max,
+                    s.s5_min, s.s5_max, s.reps, s.radius, s.bn_min, s.bn_max,
+                    s.sn_min, s.sn_max}) {
+        i32(v);
+      }
+    }
+  }
+};
+
+struct Writer {
+  FILE *mFile;
+  bool mOk = true;
+
+  void bytes(const void *data, size_t size) {
+    if (mOk && size > 0)
+      mOk = std::fwrite(data, 1, size, mFile) == size;
+  }
+  void i32(int32_t v) { bytes(&v, sizeof(v)); }
+  void f32(float v) { bytes(&v, sizeof(v)); }
+};
+
+// Checks each count against what is left of the file so a damaged file
+// can't ask for a huge allocation
+struct Reader {
+  FILE *mFile;
+  long long mLeft;
+  bool mOk = true;
+
+  void bytes(void *data, size_t size) {
+    if (!mOk || (long long)size > mLeft) {
+      mOk = false;
+      return;
+    }
+    mOk = std::fread(data, 1, size, mFile) == size;
+    mLeft -= size;
+  }
+  int32_t i32() {
+    int32_t v = 0;
+    bytes(&v, sizeof(v));
+    return v;
+  }
+  float f32() {
+    float v = 0;
+    bytes(&v, sizeof(v));
+    return v;
+  }
+  // A count of items of itemBytes each
+  int32_t count(size_t itemBytes) {
+    int32_t n = i32();
+    if (n < 0 || (long long)n * (long long)itemBytes > mLeft)
+      mOk = false;
+    return mOk ? n : 0;
+  }
+};
+
+} // namespace
+
+CaveCache::CaveCache(size_t maxBytes, const std::string &directory)
+    : mMaxBytes(maxBytes), mDirectory(directory) {}
+
+CaveCache::~CaveCache() {}
+
+uint64_t CaveCache::makeKey(const CaveInfo &info,
+                            const GenerationParams &params) {
+  Hasher h;
+  h.i32(GENERATOR_VERSION);
+  for (int v : {info.mCaveWidth, info.mCaveHeight, info.mBorderWidth,
+                info.mBorderHeight, info.mCellWidth, info.mCellHeight,
+                info.mStartCellX, info.mStartCellY, info.mLayer}) {
+    h.i32(v);
+  }
+  h.i32(params.seed);
+  h.i32(params.mOctaves);
+  h.i32(params.mPerlin);
+  h.f32(params.mWallChance);
+  h.f32(params.mFreq);
+  h.f32(params.mAmp);
+  h.steps(params.mGenerations);
+  h.i32(params.mDetectOscillation);
+  h.i32(params.mMinRoomSize);
+  h.i32(params.mPyramidScale);
+  h.steps(params.mRefineGenerations);
+  const AcceptanceCriteria &a = params.mAccept;
+  h.f32(a.mMinFloorRatio);
+  h.f32(a.mMaxFloorRatio);
+  h.i32(a.mMinRooms);
+  h.i32(a.mMaxRooms);
+  h.i32(a.mMaxTunnels);
+  return h.mHash;
+}
+
+bool CaveCache::get(uint64_t key, bool needRoomGraph, CachedCave &cave) {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mIndex.find(key);
+    if (it != mIndex.end() &&
+        (!needRoomGraph || it->second->mCave.mHasRoomGraph)) {
+      mEntries.splice(mEntries.begin(), mEntries, it->second);
+      cave = it->second->mCave;
+      mStats.mHits++;
+      return true;
+    }
+  }
+  // The file is read without the lock, another thread may put the same
+  // key meanwhile but it would be the same cave
+  CachedCave fromDisk;
+  if (!mDirectory.empty() && readFile(key, fromDisk) &&
+      (!needRoomGraph || fromDisk.mHasRoomGraph)) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    insert(key, fromDisk);
+    mStats.mHits++;
+    mStats.mDiskHits++;
+    cave = std::move(fromDisk);
+    return true;
+  }
+  std::lock_guard<std::mutex> lock(mMutex);
+  mStats.mMisses++;
+  return false;
+}
+
+void CaveCache::put(uint64_t key, const CachedCave &cave) {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    insert(key, cave);
+  }
+  if (!mDirectory.empty()) {
+    writeFile(key, cave);
+  }
+}
+
+void CaveCache::clear() {
+  std::lock_guard<std::mutex> lock(mMutex);
+  mEntries.clear();
+  mIndex.clear();
+  mStats = CacheStats();
+}
+
+void CaveCache::setMaxBytes(size_t maxBytes) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  mMaxBytes = maxBytes;
+  trim();
+}
+
+CacheStats CaveCache::getStats() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mStats;
+}
+
+void CaveCache::insert(uint64_t key, const CachedCave &cave) {
+  auto it = mIndex.find(key);
+  if (it != mIndex.end()) {
+    mStats.mBytes -= it->second->mBytes;
+    mEntries.erase(it->second);
+    mIndex.erase(it);
+  }
+  const size_t bytes = sizeOf(cave);
+  if (bytes > mMaxBytes) {
+    // Would push everything else out and then itself
+    mStats.mEntries = mEntries.size();
+    return;
+  }
+  mEntries.push_front({key, bytes, cave});
+  mIndex[key] = mEntries.begin();
+  mStats.mBytes += bytes;
+  trim();
+}
+
+void CaveCache::trim() {
+  while (mStats.mBytes > mMaxBytes && !mEntries.empty()) {
+    const Entry &oldest = mEntries.back();
+    mStats.mBytes -= oldest.mBytes;
+    mIndex.erase(oldest.mKey);
+    mEntries.pop_back();
+  }
+  mStats.mEntries = mEntries.size();
+}
+
+size_t CaveCache::sizeOf(const CachedCave &cave) {
+  size_t bytes = sizeof(Entry);
+  for (const auto &row : cave.mTileMap) {
+    bytes += sizeof(row) + row.size() * sizeof(int);
+  }
+  for (const StepStats &step : cave.mStats.mSteps) {
+    bytes += sizeof(step) + step.mChanges.size() * sizeof(int);
+  }
+  const RoomGraph &graph = cave.mRoomGraph;
+  bytes += graph.mRooms.size() * sizeof(RoomInfo) +
+           graph.mEdges.size() * sizeof(RoomEdge) +
+           graph.mLabels.size() * sizeof(int);
+  return bytes;
+}
+
+std::string CaveCache::pathFor(uint64_t key) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.cave", (unsigned long long)key);
+  return mDirectory + "/" + name;
+}
+
+//
+//   "GDCV", uint32 GENERATOR_VERSION, uint64 key
+//   int32 height, width, then a byte per tile
+//   stats: rejection, floor ratio, rooms, tunnels, steps
+//   int32 has room graph, then the graph
+//
+void CaveCache::writeFile(uint64_t key, const CachedCave &cave) const {
+  // Written to a temporary name (per thread) first so a reader never sees
+  // half a file
+  const std::string path = pathFor(key);
+  const std::string tmpPath =
+      path + "." +
+      std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) +
+      ".tmp";
+  FILE *file = std::fopen(tmpPath.c_str(), "wb");
+  if (!file) {
+    LOG_INFO("CAVE CACHE: can't write " << tmpPath);
+    return;
+  }
+  Writer w{file};
+  w.bytes(MAGIC, sizeof(MAGIC));
+  w.bytes(&GENERATOR_VERSION, sizeof(GENERATOR_VERSION));
+  w.bytes(&key, sizeof(key));
+
+  const TileMap &map = cave.mTileMap;
+  w.i32(map.size());
+  w.i32(map.empty() ? 0 : map[0].size());
+  std::vector<unsigned char> row;
+  for (const auto &tiles : map) {
+    row.assign(tiles.begin(), tiles.end());
+    w.bytes(row.data(), row.size());
+  }
+
+  const GenerationStats &stats = cave.mStats;
+  w.i32(stats.mRejection);
+  w.f32(stats.mFloorRatio);
+  w.i32(stats.mRoomCount);
+  w.i32(stats.mTunnelCount);
+  w.i32(stats.mSteps.size());
+  for (const StepStats &step : stats.mSteps) {
+    w.i32(step.mRepsRun);
+    w.i32(step.mConverged);
+    w.i32(step.mOscillating);
+    w.i32(step.mChanges.size());
+    w.bytes(step.mChanges.data(), step.mChanges.size() * sizeof(int));
+  }
+
+  w.i32(cave.mHasRoomGraph);
+  if (cave.mHasRoomGraph) {
+    const RoomGraph &graph = cave.mRoomGraph;
+    w.i32(graph.mWidth);
+    w.i32(graph.mHeight);
+    w.i32(graph.mRooms.size());
+    for (const RoomInfo &room : graph.mRooms) {
+      for (int v : {room.mId, room.mCellCount, room.mMin.x, room.mMin.y,
+                    room.mMax.x, room.mMax.y}) {
+        w.i32(v);
+      }
+      w.f32(room.mCentroidX);
+      w.f32(room.mCentroidY);
+    }
+    w.i32(graph.mEdges.size());
+    for (const RoomEdge &edge : graph.mEdges) {
+      for (int v : {edge.mRoom1, edge.mRoom2, edge.mStart.x, edge.mStart.y,
+                    edge.mDir.x, edge.mDir.y, edge.mThickness}) {
+        w.i32(v);
+      }
+    }
+    w.i32(graph.mLabels.size());
+    w.bytes(graph.mLabels.data(), graph.mLabels.size() * sizeof(int));
+  }
+
+  const bool ok = (std::fclose(file) == 0) && w.mOk;
+  std::remove(path.c_str());
+  if (!ok || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    LOG_INFO("CAVE CACHE: failed writing " << path);
+    std::remove(tmpPath.c_str());
+  }
+}
+
+bool CaveCache::readFile(uint64_t key, CachedCave &cave) const {
+  FILE *file = std::fopen(pathFor(key).c_str(), "rb");
+  if (!file) {
+    return false;
+  }
+  std::fseek(file, 0, SEEK_END);
+  Reader r{file, std::ftell(file)};
+  std::fseek(file, 0, SEEK_SET);
+
+  char magic[4];
+  uint32_t version = 0;
+  uint64_t fileKey = 0;
+  r.bytes(magic, sizeof(magic));
+  r.bytes(&version, sizeof(version));
+  r.bytes(&fileKey, sizeof(fileKey));
+  if (!r.mOk || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      version != GENERATOR_VERSION || fileKey != key) {
+    std::fclose(file);
+    return false;
+  }
+
+  const int height = r.count(1);
+  const int width = r.count(std::max(height, 1));
+  cave.mTileMap.assign(height, std::vector<int>(width));
+  std::vector<unsigned char> row(width);
+  for (int y = 0; y < height && r.mOk; ++y) {
+    r.bytes(row.data(), width);
+    cave.mTileMap[y].assign(row.begin(), row.end());
+  }
+
+  GenerationStats &stats = cave.mStats;
+  stats.clear();
+  stats.mRejection = static_cast<Rejection>(r.i32());
+  stats.mFloorRatio = r.f32();
+  stats.mRoomCount = r.i32();
+  stats.mTunnelCount = r.i32();
+  stats.mSteps.resize(r.count(4 * sizeof(int32_t)));
+  for (StepStats &step : stats.mSteps) {
+    step.mRepsRun = r.i32();
+    step.mConverged = r.i32();
+    step.mOscillating = r.i32();
+    step.mChanges.resize(r.count(sizeof(int)));
+    r.bytes(step.mChanges.data(), step.mChanges.size() * sizeof(int));
+  }
+
+  cave.mRoomGraph.clear();
+  cave.mHasRoomGraph = r.i32();
+  if (cave.mHasRoomGraph) {
+    RoomGraph &graph = cave.mRoomGraph;
+    graph.mWidth = r.i32();
+    graph.mHeight = r.i32();
+    graph.mRooms.resize(r.count(8 * sizeof(int32_t)));
+    for (RoomInfo &room : graph.mRooms) {
+      room.mId = r.i32();
+      room.mCellCount = r.i32();
+      room.mMin.x = r.i32();
+      room.mMin.y = r.i32();
+      room.mMax.x = r.i32();
+      room.mMax.y = r.i32();
+      room.mCentroidX = r.f32();
+      room.mCentroidY = r.f32();
+    }
+    graph.mEdges.resize(r.count(7 * sizeof(int32_t)));
+    for (RoomEdge &edge : graph.mEdges) {
+      edge.mRoom1 = r.i32();
+      edge.mRoom2 = r.i32();
+      edge.mStart.x = r.i32();
+      edge.mStart.y = r.i32();
+      edge.mDir.x = r.i32();
+      edge.mDir.y = r.i32();
+      edge.mThickness = r.i32();
+    }
+    graph.mLabels.resize(r.count(sizeof(int)));
+    r.bytes(graph.mLabels.data(), graph.mLabels.size() * sizeof(int));
+  }
+  std::fclose(file);
+  if (!r.mOk) {
+    LOG_INFO("CAVE CACHE: ignoring damaged " << pathFor(key));
+  }
+  return r.mOk;
+}
+
+} // namespace Cave
@@ -0,0 +1,93 @@
+#ifndef CAVE_CACHE_H
+#define CAVE_CACHE_H
+
+#include "CaveInfo.h"
+#include "GenerationParams.h"
+#include "GenerationStats.h"
+#include "RoomGraph.h"
+#include "TileTypes.h"
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace Cave {
+
+// Bump whenever a change to the generator alters the maps it makes, so
+// older cache files are ignored
+static const uint32_t GENERATOR_VERSION = 1;
+
+// What Cave::generate made for one set of inputs
+struct CachedCave {
+  TileMap mTileMap;
+  GenerationStats mStats;
+  // Only if it was generated with a RoomGraph
+  bool mHasRoomGraph = false;
+  RoomGraph mRoomGraph;
+};
+
+struct CacheStats {
+  int mHits = 0;
+  // Misses in memory that were found on disk (also counted in mHits)
+  int mDiskHits = 0;
+  int mMisses = 0;
+  int mEntries = 0;
+  size_t mBytes = 0;
+};
+
+//
+// LRU cache of generated caves, keyed by makeKey. Entries are dropped
+// (least recently used first) to keep under maxBytes. With a directory
+// every entry is also written there as <key>.cave and read back on a
+// memory miss, so it lasts between runs (files are native byte order).
+//
+// Safe to share between threads.
+//
+class CaveCache {
+public:
+  explicit CaveCache(size_t maxBytes, const std::string &directory = "");
+  ~CaveCache();
+
+  // Hash of everything that changes the generated map (not the threads or
+  // grid layout) plus GENERATOR_VERSION
+  static uint64_t makeKey(const CaveInfo &info, const GenerationParams &params);
+
+  // false on a miss, or if needRoomGraph and the entry has none
+  bool get(uint64_t key, bool needRoomGraph, CachedCave &cave);
+  void put(uint64_t key, const CachedCave &cave);
+
+  void clear();
+  void setMaxBytes(size_t maxBytes);
+  CacheStats getStats() const;
+
+  // Roughly the memory a cave takes
+  static size_t sizeOf(const CachedCave &cave);
+
+private:
+  struct Entry {
+    uint64_t mKey;
+    size_t mBytes;
+    CachedCave mCave;
+  };
+
+  std::string pathFor(uint64_t key) const;
+  bool readFile(uint64_t key, CachedCave &cave) const;
+  void writeFile(uint64_t key, const CachedCave &cave) const;
+  // Caller holds mMutex
+  void insert(uint64_t key, const CachedCave &cave);
+  void trim();
+
+  size_t mMaxBytes;
+  std::string mDirectory;
+  mutable std::mutex mMutex;
+  // Most recently used at the front
+  std::list<Entry> mEntries;
+  std::unordered_map<uint64_t, std::list<Entry>::iterator> mIndex;
+  CacheStats mStats;
+};
+
+} // namespace Cave
+
+#endif
@@ -8,11 +8,15 @@
 #include "CaveSmoother.h"
 #include "Cave.h"
 #include "CaveInfo.h"
+#include "Parallel.h"
+#include "RowSink.h"
 #include "TileTypes.h"
+#include "Trace.h"
+#include <algorithm>
 #include <iostream>
+#include <mutex>
 #include <vector>
 
-
 #include "Debug.h"
 
 namespace Cave {
@@ -241,6 +245,17 @@ UpdateInfo updates[] = {
     { TileGrid28n,  0, 0, 0,0, 0,0, FLOOR, IGNORE}
 #endif
 };
+const int NUM_UPDATES = sizeof(updates) / sizeof(updates[0]);
+
+// A match of an update at a pos (the top left of its 4x4)
+struct Match {
+  int x;
+  int y;
+  int update;
+};
+
+// Smallest band worth giving its own thread
+const int MIN_BAND_ROWS = 32;
 
 //
 // Use the patterns to calc and modify the updates with mask,value and offsets
@@ -310,9 +325,12 @@ void createUpdateInfos() {
 
 //////////////////////////////////////////////////
 
-CaveSmoother::CaveSmoother(TileMap &tm, const CaveInfo &i)
-    : info(i), tileMap(tm) {
-  createUpdateInfos();
+CaveSmoother::CaveSmoother(TileMap &tm, const CaveInfo &i, int t,
+                           const CancelToken *c)
+    : info(i), tileMap(tm), threads(t), cancel(c) {
+  // The updates are shared so only fill them in once
+  static std::once_flag created;
+  std::call_once(created, createUpdateInfos);
 }
 
 CaveSmoother::~CaveSmoother() {}
@@ -346,93 +364,168 @@ void CaveSmoother::smoothEdges() {
     }
   }
   //
-  // Smooth the grid
+  // Find the matching update(s) for every pos. This only reads inGrid so
+  // is done in bands of rows in parallel. Each band keeps its matches in
+  // the same (raster then update) order the loop would find them.
   //
-  for (int y = 0; y < info.mCaveHeight - 1; y++) {
-    for (int x = 0; x < info.mCaveWidth - 1; x++) {
-
-      // Get the value of the 4x4 grid
-      LOG_DEBUG("==MASK value " << x << "," << y);
-      int value = 0;
-      int shift = (GRD_H * GRD_W) - 1;
-      for (int r = 0; r < GRD_H; ++r) {
+  const int rows = info.mCaveHeight - 1;
+  const int cols = info.mCaveWidth - 1;
+  if (rows <= 0 || cols <= 0)
+    return;
+  const int bands = bandCount(rows, threads, MIN_BAND_ROWS);
+  const int rowsPerBand = (rows + bands - 1) / bands;
+  std::vector<std::vector<Match>> bandMatches(bands);
+  parallelFor(bands, [&](int b) {
+    TraceScope trace("smooth_match", -1, b);
+    const int yEnd = std::min(rows, (b + 1) * rowsPerBand);
+    // Nibble per pos of the 4 cells across from it, for each grid row
+    std::vector<std::vector<int>> nibbles(GRD_H, std::vector<int>(cols));
+    auto fillNibbles = [&](std::vector<int> &row, int gy) {
+      const std::vector<int> &in = inGrid[gy];
+      for (int x = 0; x < cols; ++x) {
+        int n = 0;
         for (int c = 0; c < GRD_W; ++c) {
-          if (inGrid[y + r][x + c] == SOLID) {
-            value |= (1 << shift);
+          n = (n << 1) | (in[x + c] == SOLID ? 1 : 0);
+        }
+        row[x] = n;
+      }
+    };
+    for (int y = b * rowsPerBand; y < yEnd; ++y) {
+      if (isCancelled(cancel))
+        return;
+      if (y == b * rowsPerBand) {
+        for (int r = 0; r < GRD_H; ++r) {
+          fillNibbles(nibbles[r], y + r);
+        }
+      } else {
+        std::rotate(nibbles.begin(), nibbles.begin() + 1, nibbles.end());
+        fillNibbles(nibbles[GRD_H - 1], y + GRD_H - 1);
+      }
+      for (int x = 0; x < cols; ++x) {
+        // Get the value of the 4x4 grid
+        int value = 0;
+        for (int r = 0; r < GRD_H; ++r) {
+          value = (value << GRD_W) | nibbles[r][x];
+        }
+        for (int idx = 0; idx < NUM_UPDATES; ++idx) {
+          if ((value & updates[idx].mask) == updates[idx].value) {
+            bandMatches[b].push_back({x, y, idx});
           }
-          --shift;
         }
       }
-      LOG_DEBUG("==FIND " << x << "," << y << " val:" << std::hex << value
-                          << std::dec);
-
-      // Find the matching update(s) for that value
-      //
-#if 0
-            for (const auto& up : updates) {
-                if ( (value&up.mask) == up.value) {
-					Vector2i pos1{x+ up.xoff1, y+ up.yoff1};
-					Vector2i pos2{x+ up.xoff2, y+ up.yoff2};
-                	// Ensure not smoothed it already
-                	// - can check both pos since p2 == p1 if no 2nd tile
-                	if ((smoothedGrid[pos1.y][pos1.x] == IGNORE)
-                	 && (smoothedGrid[pos2.y][pos2.x] == IGNORE)) {
-                		// Smooth the first (N) tile
-                		// - Need to translate the grid pos back to cave pos
-						LOG_INFO("SMOOTH " << x << "," << y << " " << up.t1 << "," << up.t2);
-						Cave::setCell(tileMap, pos1.x-1,pos1.y-1, up.t1);
-                		smoothedGrid[pos1.y][pos1.x] = SMOOTHED;
-                		// Check if there is a second (M) tile
-                		if (up.t2 != IGNORE) {
-                			// Smooth the second (M) tile
-                			// - Need to translate the grid pos back to cave pos
-							Cave::setCell(tileMap, pos2.x-1,pos2.y-1, up.t2);
-                			smoothedGrid[pos2.y][pos2.x] = SMOOTHED;
-                		}
-                	}
-                }
-            }
-#else
-      int idx = 0;
-      for (const auto &up : updates) {
-        LOG_DEBUG("  NEXT up:" << idx << " msk:" << std::hex << up.mask
-                               << " val:" << up.value << " inVal:" << value
-                               << " and:" << (value & up.mask) << std::dec);
-        if ((value & up.mask) == up.value) {
-          Vector2i pos1{x + up.xoff1, y + up.yoff1};
-          Vector2i pos2{x + up.xoff2, y + up.yoff2};
+    }
+  });
 
-          LOG_DEBUG("      FOUND1 up:" << idx << " p1:" << pos1.x << ","
-                                       << pos1.y << " p2:" << pos2.x << ","
-                                       << pos2.y);
-          // Ensure not smoothed it already
-          // - can check both pos since p2 == p1 if no 2nd tile
-          if ((smoothedGrid[pos1.y][pos1.x] == IGNORE) &&
-              (smoothedGrid[pos2.y][pos2.x] == IGNORE)) {
-            LOG_DEBUG("         SMOOTH1 -> " << up.t1);
-            // Smooth the first (N) tile
-            // - Need to translate the grid pos back to cave pos
-            Cave::setCell(tileMap, pos1.x - 1, pos1.y - 1, up.t1);
-            smoothedGrid[pos1.y][pos1.x] = SMOOTHED;
-            // Check if there is a second (M) tile
-            if (up.t2 != IGNORE) {
-              LOG_DEBUG("      FOUND2 " << pos2.x << "," << pos2.y);
-              LOG_DEBUG("         SMOOTH2 -> " << up.t2);
-              // Smooth the second (M) tile
-              // - Need to translate the grid pos back to cave pos
-              Cave::setCell(tileMap, pos2.x - 1, pos2.y - 1, up.t2);
-              smoothedGrid[pos2.y][pos2.x] = SMOOTHED;
-            } else {
-              LOG_DEBUG("  IGNORE TILE2: " << pos2.x << "," << pos2.y);
-            }
-          } else {
-            LOG_DEBUG("  IGNORE p1:" << smoothedGrid[pos1.y][pos1.x]
-                                     << " p2:" << smoothedGrid[pos2.y][pos2.x]);
-          }
+  //
+  // Apply the matches. Whether one is used depends on which tiles the
+  // earlier ones smoothed, so this is done in order to give the same
+  // result as a single raster scan. It only visits the matches, which are
+  // along the edges, rather than every pos.
+  //
+  if (isCancelled(cancel))
+    return;
+  TraceScope trace("smooth_apply");
+  for (const auto &matches : bandMatches) {
+    for (const Match &m : matches) {
+      const UpdateInfo &up = updates[m.update];
+      Vector2i pos1{m.x + up.xoff1, m.y + up.yoff1};
+      Vector2i pos2{m.x + up.xoff2, m.y + up.yoff2};
+      LOG_DEBUG("      FOUND1 up:" << m.update << " p1:" << pos1.x << ","
+                                   << pos1.y << " p2:" << pos2.x << ","
+                                   << pos2.y);
+      // Ensure not smoothed it already
+      // - can check both pos since p2 == p1 if no 2nd tile
+      if ((smoothedGrid[pos1.y][pos1.x] == IGNORE) &&
+          (smoothedGrid[pos2.y][pos2.x] == IGNORE)) {
+        LOG_DEBUG("         SMOOTH1 -> " << up.t1);
+        // Smooth the first (N) tile
+        // - Need to translate the grid pos back to cave pos
+        Cave::setCell(tileMap, pos1.x - 1, pos1.y - 1, up.t1);
+        smoothedGrid[pos1.y][pos1.x] = SMOOTHED;
+        // Check if there is a second (M) tile
+        if (up.t2 != IGNORE) {
+          LOG_DEBUG("         SMOOTH2 -> " << up.t2);
+          // Smooth the second (M) tile
+          // - Need to translate the grid pos back to cave pos
+          Cave::setCell(tileMap, pos2.x - 1, pos2.y - 1, up.t2);
+          smoothedGrid[pos2.y][pos2.x] = SMOOTHED;
         }
-        ++idx;
+      } else {
+        LOG_DEBUG("  IGNORE p1:" << smoothedGrid[pos1.y][pos1.x]
+                                 << " p2:" << smoothedGrid[pos2.y][pos2.x]);
+      }
+    }
+  }
+}
+
+//////////////////////////////////////////////////
+
+RowSmoother::RowSmoother(const CaveInfo &i, RowSink &s) : info(i), sink(s) {
+  static std::once_flag created;
+  std::call_once(created, createUpdateInfos);
+}
+
+RowSmoother::~RowSmoother() {}
+
+//
+// Grid coords are TileMap coords here (smoothEdges' shift by 1,1 is the
+// TileMap border), so anchor row y covers TileMap rows y .. y+3.
+//
+void RowSmoother::addRow(const std::vector<int> &row) {
+  const int y = nextRow++;
+  Row r;
+  r.y = y;
+  r.tiles = row;
+  r.solid.assign(info.mCaveWidth + GRD_W + 1, 1);
+  r.smoothed.assign(info.mCaveWidth + 2, 0);
+  if (y >= 1 && y <= info.mCaveHeight) {
+    for (int x = 1; x <= info.mCaveWidth; ++x) {
+      r.solid[x] = (row[x] == WALL) ? 1 : 0;
+    }
+  }
+  rows.push_back(std::move(r));
+
+  if ((int)rows.size() == GRD_H) {
+    const int anchor = rows.front().y;
+    if (anchor <= info.mCaveHeight - 2) {
+      smoothRow();
+    }
+    sink.writeRow(anchor, rows.front().tiles);
+    rows.pop_front();
+  }
+  if (y == info.mCaveHeight + 1) {
+    for (const Row &done : rows) {
+      sink.writeRow(done.y, done.tiles);
+    }
+    rows.clear();
+  }
+}
+
+void RowSmoother::smoothRow() {
+  for (int x = 0; x < info.mCaveWidth - 1; x++) {
+    int value = 0;
+    for (int r = 0; r < GRD_H; ++r) {
+      const uint8_t *solid = &rows[r].solid[x];
+      for (int c = 0; c < GRD_W; ++c) {
+        value = (value << 1) | solid[c];
+      }
+    }
+    for (const auto &up : updates) {
+      if ((value & up.mask) != up.value)
+        continue;
+      Row &row1 = rows[up.yoff1];
+      Row &row2 = rows[up.yoff2];
+      const int x1 = x + up.xoff1;
+      const int x2 = x + up.xoff2;
+      // Ensure not smoothed it already
+      if (row1.smoothed[x1] || row2.smoothed[x2])
+        continue;
+      row1.tiles[x1] = up.t1;
+      row1.smoothed[x1] = 1;
+      if (up.t2 != IGNORE) {
+        row2.tiles[x2] = up.t2;
+        row2.smoothed[x2] = 1;
       }
-#endif
     }
   }
 }
@@ -1,14 +1,21 @@
 #ifndef CAVE_SMOOTHER_H
 #define CAVE_SMOOTHER_H
 
+#include "CancelToken.h"
 #include "CaveInfo.h"
 #include "TileTypes.h"
+#include <cstdint>
+#include <deque>
+#include <vector>
 
 namespace Cave {
 
 class CaveSmoother {
 public:
-  CaveSmoother(TileMap &tm, const CaveInfo &i);
+  // threads: for finding the pattern matches, <= 0 is one per core
+  // cancel: checked each row, the map is left part smoothed if it is set
+  CaveSmoother(TileMap &tm, const CaveInfo &i, int threads = 1,
+               const CancelToken *cancel = nullptr);
   ~CaveSmoother();
 
   void smoothEdges();
@@ -16,6 +23,40 @@ public:
 private:
   TileMap &tileMap;
   const CaveInfo &info;
+  int threads;
+  const CancelToken *cancel;
+};
+
+class RowSink;
+
+//
+// The same smoothing for a map that is never held all at once. It is fed
+// the TileMap (WALL/FLOOR) a row at a time, border rows included, and
+// passes each row on to the sink once no later 4x4 can change it, which
+// is 3 rows behind. The result is identical to smoothEdges.
+//
+class RowSmoother {
+public:
+  RowSmoother(const CaveInfo &i, RowSink &s);
+  ~RowSmoother();
+
+  // TileMap rows 0 .. mCaveHeight + 1 in order
+  void addRow(const std::vector<int> &row);
+
+private:
+  struct Row {
+    int y;
+    std::vector<int> tiles;
+    // As smoothEdges' inGrid (1 = SOLID) and smoothedGrid (1 = SMOOTHED)
+    std::vector<uint8_t> solid;
+    std::vector<uint8_t> smoothed;
+  };
+  void smoothRow();
+
+  const CaveInfo &info;
+  RowSink &sink;
+  int nextRow = 0;
+  std::deque<Row> rows;
 };
 
 } // namespace Cave
@@ -0,0 +1,457 @@
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <unordered_map>
+
+#include "CaveSmoother.h"
+#include "CaveStreamer.h"
+#include "CellularAutomata.h"
+#include "RandSimple.h"
+#include "RoomLabeler.h"
+#include "Trace.h"
+
+#include "Debug.h"
+
+namespace Cave {
+
+CaveStreamer::CaveStreamer(CaveInfo &info, const GenerationParams &params,
+                           int bandRows)
+    : mInfo(info), mParams(params), mBandRows(std::max(1, bandRows)),
+      mCave(info, params) {}
+
+CaveStreamer::~CaveStreamer() {}
+
+//
+// Each CA rep can only move a change its count radius (the 5x5 is always
+// counted) and each fixUp pass 1 cell, so that far past the band is all
+// that can affect it.
+//
+int CaveStreamer::getHalo() const {
+  int halo = Cave::FIXUP_PASSES;
+  for (const GenerationStep &step : mParams.mGenerations) {
+    halo += step.reps * std::max(2, step.radius);
+  }
+  return halo;
+}
+
+bool CaveStreamer::generate(RowSink &sink) {
+  mStats.clear();
+  const AcceptanceCriteria &accept = mParams.mAccept;
+  if (mParams.mPyramidScale > 1) {
+    LOG_INFO("CaveStreamer: mPyramidScale " << mParams.mPyramidScale
+                                            << " isn't supported");
+    reject(FAILED);
+    return false;
+  }
+
+  FILE *labelFile = std::tmpfile();
+  if (!labelFile) {
+    LOG_INFO("CaveStreamer: can't create the temp file");
+    reject(FAILED);
+    return false;
+  }
+  RoomSets rooms;
+  std::vector<int> roomCells;
+  bool accepted = false;
+  if (!labelBands(labelFile, rooms, roomCells)) {
+    reject(isCancelled(mCancel) ? CANCELLED : FAILED);
+  } else if (mStats.mFloorRatio < accept.mMinFloorRatio ||
+             mStats.mFloorRatio > accept.mMaxFloorRatio) {
+    reject(REJECT_FLOOR_RATIO);
+  } else {
+    std::vector<int> roomOf = cullSmallRooms(rooms, roomCells);
+    if (mStats.mRoomCount < accept.mMinRooms ||
+        (accept.mMaxRooms >= 0 && mStats.mRoomCount > accept.mMaxRooms)) {
+      reject(REJECT_ROOM_COUNT);
+    } else {
+      std::vector<Cave::BorderWall> mst = joinRooms(labelFile, roomOf);
+      mStats.mTunnelCount = mst.size();
+      if (isCancelled(mCancel)) {
+        reject(CANCELLED);
+      } else if (accept.mMaxTunnels >= 0 &&
+                 mStats.mTunnelCount > accept.mMaxTunnels) {
+        reject(REJECT_TUNNEL_COUNT);
+      } else if (!writeRows(labelFile, roomOf, mst, sink)) {
+        reject(FAILED);
+      } else {
+        accepted = true;
+      }
+    }
+  }
+  std::fclose(labelFile);
+  return accepted;
+}
+
+void CaveStreamer::reject(Rejection rejection) {
+  LOG_INFO("STREAMED CAVE REJECTED: " << rejection
+                                      << " floor: " << mStats.mFloorRatio
+                                      << " rooms: " << mStats.mRoomCount
+                                      << " tunnels: " << mStats.mTunnelCount);
+  mStats.mRejection = rejection;
+}
+
+int CaveStreamer::RoomSets::find(int room) {
+  while (parent[room] != room) {
+    parent[room] = parent[parent[room]];
+    room = parent[room];
+  }
+  return room;
+}
+
+void CaveStreamer::RoomSets::join(int room1, int room2) {
+  room1 = find(room1);
+  room2 = find(room2);
+  if (room1 < room2) {
+    parent[room2] = room1;
+  } else if (room2 < room1) {
+    parent[room1] = room2;
+  }
+}
+
+//
+// The noise rows are made once, in order (the random fill needs that), and
+// kept while a band's window needs them. Each band's labels are offset to
+// be unique and joined to the labels of the row above where floors touch.
+//
+bool CaveStreamer::labelBands(FILE *labelFile, RoomSets &rooms,
+                              std::vector<int> &roomCells) {
+  const int W = mInfo.mCaveWidth;
+  const int H = mInfo.mCaveHeight;
+  const int halo = getHalo();
+  RNG::RandSimple simple(mParams.seed);
+  std::deque<std::vector<uint8_t>> noise;
+  int noiseStart = 0;
+  int noiseEnd = 0;
+  std::vector<int> above(W, -1);
+  std::vector<uint8_t> runs;
+  long long floors = 0;
+
+  for (int y0 = 0; y0 < H; y0 += mBandRows) {
+    const int y1 = std::min(H, y0 + mBandRows);
+    const int w0 = std::max(0, y0 - halo);
+    const int w1 = std::min(H, y1 + halo);
+    const int rows = w1 - w0;
+    TraceScope trace("stream_band", -1, y0 / mBandRows);
+    while (noiseEnd < w1) {
+      noise.emplace_back();
+      mCave.noiseRow(noiseEnd++, simple, noise.back());
+    }
+    while (noiseStart < w0) {
+      noise.pop_front();
+      ++noiseStart;
+    }
+
+    CellularAutomata ca(W, rows, mParams.mGridLayout);
+    ca.setCancelToken(mCancel);
+    for (int r = 0; r < rows; ++r) {
+      const std::vector<uint8_t> &walls = noise[w0 - noiseStart + r];
+      for (int cx = 0; cx < W; ++cx) {
+        ca.setWall(cx, r, walls[cx] != 0);
+      }
+    }
+    for (const auto &gen : mParams.mGenerations) {
+      ca.runStep(gen, mParams.mDetectOscillation);
+    }
+    if (isCancelled(mCancel))
+      return false;
+    for (int cy = y0; cy < y1; ++cy) {
+      for (int cx = 0; cx < W; ++cx) {
+        floors += ca.isWall(cx, cy - w0) ? 0 : 1;
+      }
+    }
+
+    // fixUp the window as if it was a whole cave
+    CaveInfo windowInfo = mInfo;
+    windowInfo.mCaveHeight = rows;
+    TileMap window(rows + 2, std::vector<int>(W + 2, WALL));
+    for (int r = 0; r < rows; ++r) {
+      for (int cx = 0; cx < W; ++cx) {
+        Cave::setCell(window, cx, r, ca.isWall(cx, r) ? WALL : FLOOR);
+      }
+    }
+    Cave(windowInfo, mParams).fixUp(window);
+
+    const int bandRows = y1 - y0;
+    std::vector<uint8_t> mask(bandRows * W);
+    for (int r = 0; r < bandRows; ++r) {
+      for (int cx = 0; cx < W; ++cx) {
+        mask[r * W + cx] = Cave::isFloor(window, cx, y0 - w0 + r) ? 1 : 0;
+      }
+    }
+    std::vector<int> labels;
+    const int count =
+        RoomLabeler::label(mask, W, bandRows, mParams.mThreads, labels);
+    const int base = rooms.parent.size();
+    for (int i = 0; i < count; ++i) {
+      rooms.parent.push_back(base + i);
+    }
+    roomCells.resize(base + count, 0);
+    for (int &label : labels) {
+      if (label >= 0) {
+        label += base;
+        roomCells[label]++;
+      }
+    }
+    for (int cx = 0; cx < W; ++cx) {
+      if (labels[cx] >= 0 && above[cx] >= 0) {
+        rooms.join(labels[cx], above[cx]);
+      }
+    }
+    std::copy(labels.end() - W, labels.end(), above.begin());
+    runs.clear();
+    for (int r = 0; r < bandRows; ++r) {
+      writeLabelRow(&labels[r * W], runs);
+    }
+    if (std::fwrite(runs.data(), 1, runs.size(), labelFile) != runs.size()) {
+      LOG_INFO("CaveStreamer: temp file write failed at row " << y0);
+      return false;
+    }
+  }
+  mStats.mFloorRatio = (W * H > 0) ? (float)((double)floors / W / H) : 0;
+  LOG_INFO("STREAMED BANDS: " << (H + mBandRows - 1) / mBandRows
+                              << " halo: " << halo
+                              << " labels: " << rooms.parent.size()
+                              << " temp bytes: " << std::ftell(labelFile));
+  return true;
+}
+
+//
+// As Cave::cullSmallRooms, on the summed label counts. The largest room
+// is kept and on a tie the one first in raster order (the lowest root).
+//
+std::vector<int> CaveStreamer::cullSmallRooms(RoomSets &rooms,
+                                              const std::vector<int> &roomCells) {
+  const int labels = rooms.parent.size();
+  std::vector<int> roomOf(labels);
+  std::vector<long long> cells(labels, 0);
+  for (int i = 0; i < labels; ++i) {
+    roomOf[i] = rooms.find(i);
+    cells[roomOf[i]] += roomCells[i];
+  }
+  int largest = -1;
+  for (int i = 0; i < labels; ++i) {
+    if (roomOf[i] == i && (largest < 0 || cells[i] > cells[largest])) {
+      largest = i;
+    }
+  }
+  std::vector<uint8_t> keep(labels, 1);
+  int culled = 0;
+  int left = 0;
+  for (int i = 0; i < labels; ++i) {
+    if (roomOf[i] != i)
+      continue;
+    if (mParams.mMinRoomSize > 1 && i != largest &&
+        cells[i] < mParams.mMinRoomSize) {
+      keep[i] = 0;
+      ++culled;
+    } else {
+      ++left;
+    }
+  }
+  for (int i = 0; i < labels; ++i) {
+    if (!keep[roomOf[i]]) {
+      roomOf[i] = -1;
+    }
+  }
+  mStats.mRoomCount = left;
+  LOG_INFO("STREAMED ROOMS: " << left << " culled: " << culled);
+  return roomOf;
+}
+
+namespace {
+
+// 7 bits a byte, low first, the top bit set on all but the last
+void putVarint(std::vector<uint8_t> &out, uint32_t value) {
+  while (value >= 0x80) {
+    out.push_back((uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back((uint8_t)value);
+}
+
+bool getVarint(FILE *file, uint32_t &value) {
+  value = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    const int byte = std::getc(file);
+    if (byte == EOF)
+      return false;
+    value |= (uint32_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+// Small either way from 0 (labels next to each other are close)
+uint32_t zigzag(int v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+int unzigzag(uint32_t v) { return (int)(v >> 1) ^ -(int)(v & 1); }
+
+} // namespace
+
+//
+// A row is its number of runs of floor then for each the gap since the
+// last run, its length less one and its label less the last run's. A
+// run is all one room, so that is all the labels there are.
+//
+void CaveStreamer::writeLabelRow(const int *labels,
+                                 std::vector<uint8_t> &out) const {
+  const int W = mInfo.mCaveWidth;
+  int count = 0;
+  std::vector<uint8_t> row;
+  int end = 0;
+  int lastLabel = 0;
+  for (int x = 0; x < W;) {
+    if (labels[x] < 0) {
+      ++x;
+      continue;
+    }
+    int start = x;
+    while (x < W && labels[x] == labels[start]) {
+      ++x;
+    }
+    putVarint(row, start - end);
+    putVarint(row, x - start - 1);
+    putVarint(row, zigzag(labels[start] - lastLabel));
+    lastLabel = labels[start];
+    end = x;
+    ++count;
+  }
+  putVarint(out, count);
+  out.insert(out.end(), row.begin(), row.end());
+}
+
+bool CaveStreamer::readRow(FILE *labelFile, std::vector<int> &labels) {
+  const int W = mInfo.mCaveWidth;
+  labels.assign(W, -1);
+  uint32_t count;
+  if (!getVarint(labelFile, count))
+    return false;
+  int end = 0;
+  int lastLabel = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t gap, length, label;
+    if (!getVarint(labelFile, gap) || !getVarint(labelFile, length) ||
+        !getVarint(labelFile, label))
+      return false;
+    const int start = end + (int)gap;
+    end = start + (int)length + 1;
+    if (start < 0 || end > W)
+      return false;
+    lastLabel += unzigzag(label);
+    std::fill(labels.begin() + start, labels.begin() + end, lastLabel);
+  }
+  return true;
+}
+
+//
+// The border walls are the straight runs of wall between floors of two
+// rooms. Keeping the last floor seen along the row and down each column
+// finds them all in one pass. Only the first for each pair of rooms in
+// the MST's order (Cave::wallBefore) can be picked by it, so only that one
+// is kept, and the MST is the same as Cave::generate's.
+//
+std::vector<Cave::BorderWall>
+CaveStreamer::joinRooms(FILE *labelFile, const std::vector<int> &roomOf) {
+  const int W = mInfo.mCaveWidth;
+  std::map<std::pair<int, int>, Cave::BorderWall> thinnest;
+  auto addWall = [&](Vector2i floor1, int room1, Vector2i floor2, int room2,
+                     Vector2i dir, int thickness) {
+    if (room1 == room2)
+      return;
+    std::pair<int, int> key(std::min(room1, room2), std::max(room1, room2));
+    const Cave::BorderWall wall = {floor1, floor2, dir, room1, room2,
+                                   thickness};
+    auto it = thinnest.find(key);
+    if (it == thinnest.end() || Cave::wallBefore(wall, it->second)) {
+      thinnest[key] = wall;
+    }
+  };
+
+  std::vector<int> colY(W, -1);
+  std::vector<int> colRoom(W, -1);
+  std::vector<int> labels;
+  std::rewind(labelFile);
+  for (int cy = 0; cy < mInfo.mCaveHeight && !isCancelled(mCancel) &&
+                  readRow(labelFile, labels);
+       ++cy) {
+    int lastX = -1;
+    int lastRoom = -1;
+    for (int cx = 0; cx < W; ++cx) {
+      const int room = (labels[cx] >= 0) ? roomOf[labels[cx]] : -1;
+      if (room < 0)
+        continue;
+      if (lastX >= 0 && cx - lastX > 1) {
+        addWall({lastX, cy}, lastRoom, {cx, cy}, room, {1, 0}, cx - lastX - 1);
+      }
+      lastX = cx;
+      lastRoom = room;
+      if (colY[cx] >= 0 && cy - colY[cx] > 1) {
+        addWall({cx, colY[cx]}, colRoom[cx], {cx, cy}, room, {0, 1},
+                cy - colY[cx] - 1);
+      }
+      colY[cx] = cy;
+      colRoom[cx] = room;
+    }
+  }
+
+  std::vector<Cave::BorderWall> borderWalls;
+  std::vector<int> roomIds;
+  for (const auto &entry : thinnest) {
+    borderWalls.push_back(entry.second);
+  }
+  for (int i = 0; i < (int)roomOf.size(); ++i) {
+    if (roomOf[i] == i) {
+      roomIds.push_back(i);
+    }
+  }
+  return mCave.findMST_Kruskal(borderWalls, roomIds);
+}
+
+bool CaveStreamer::writeRows(FILE *labelFile, const std::vector<int> &roomOf,
+                             const std::vector<Cave::BorderWall> &mst,
+                             RowSink &sink) {
+  const int W = mInfo.mCaveWidth;
+  const int H = mInfo.mCaveHeight;
+  // The tunnel cells by row, from the cell after floor1 (as joinRooms)
+  std::unordered_map<int, std::vector<int>> tunnels;
+  for (const Cave::BorderWall &wall : mst) {
+    int wx = wall.floor1.x + wall.dir.x;
+    int wy = wall.floor1.y + wall.dir.y;
+    for (int i = 0; i < wall.thickness; ++i) {
+      tunnels[wy].push_back(wx);
+      wx += wall.dir.x;
+      wy += wall.dir.y;
+    }
+  }
+
+  sink.begin(W + 2, H + 2);
+  RowSmoother smoother(mInfo, sink);
+  std::vector<int> row(W + 2, WALL);
+  smoother.addRow(row);
+  std::vector<int> labels;
+  std::rewind(labelFile);
+  for (int cy = 0; cy < H; ++cy) {
+    if (!readRow(labelFile, labels)) {
+      LOG_INFO("CaveStreamer: temp file read failed at row " << cy);
+      sink.end();
+      return false;
+    }
+    for (int cx = 0; cx < W; ++cx) {
+      const bool floor = labels[cx] >= 0 && roomOf[labels[cx]] >= 0;
+      row[cx + 1] = floor ? FLOOR : WALL;
+    }
+    auto it = tunnels.find(cy);
+    if (it != tunnels.end()) {
+      for (int cx : it->second) {
+        row[cx + 1] = FLOOR;
+      }
+    }
+    smoother.addRow(row);
+  }
+  std::fill(row.begin(), row.end(), WALL);
+  smoother.addRow(row);
+  sink.end();
+  return true;
+}
+
+} // namespace Cave
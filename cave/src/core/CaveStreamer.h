@@ -0,0 +1,85 @@
+#ifndef CAVE_STREAMER_H
+#define CAVE_STREAMER_H
+
+#include "CancelToken.h"
+#include "Cave.h"
+#include "CaveInfo.h"
+#include "GenerationParams.h"
+#include "GenerationStats.h"
+#include "RowSink.h"
+#include <cstdio>
+#include <vector>
+
+namespace Cave {
+
+//
+// Generates a cave that is too big to hold in memory a band of rows at a
+// time. Peak memory is a band (plus halo) of rows and some per room data;
+// the room labels go through a temp file and the TileMap to a RowSink.
+// The temp file holds each row's runs of floor and their labels (a few
+// bytes a run), so is usually well under the finished map's byte a tile.
+//
+// 1. Noise, CA and fixUp for each band plus getHalo() rows either side,
+//    enough for the band to come out exactly as it would on the whole map.
+//    The band's rooms are labelled and joined up with the band above.
+// 2. The small rooms are culled and the border walls are found from the
+//    labels, keeping the first between each pair of rooms in the MST's
+//    order (Cave::wallBefore).
+// 3. The floors plus tunnels are smoothed a row at a time into the sink.
+//
+// So the result is the same as Cave::generate (cave_bench check compares
+// them). The room graph, the per step stats and the stage times aren't
+// supported, and params with mPyramidScale > 1 are rejected (FAILED).
+//
+class CaveStreamer {
+public:
+  CaveStreamer(CaveInfo &info, const GenerationParams &params,
+               int bandRows = 256);
+  ~CaveStreamer();
+
+  // false if the cave fails the mParams.mAccept criteria or is cancelled
+  // (the sink is then not written to), or FAILED (see the log) in which
+  // case the sink may have been partly written
+  bool generate(RowSink &sink);
+  const GenerationStats &getStats() const { return mStats; }
+  // Checked between CA reps, bands and rows until the sink is written to,
+  // generate stops once it is cancelled
+  void setCancelToken(const CancelToken *token) { mCancel = token; }
+
+  // Rows generated either side of each band
+  int getHalo() const;
+
+private:
+  // Union find of the per band room labels (the root is the lowest label)
+  struct RoomSets {
+    std::vector<int> parent;
+    int find(int room);
+    void join(int room1, int room2);
+  };
+
+  // false if cancelled or the temp file couldn't be written
+  bool labelBands(FILE *labelFile, RoomSets &rooms,
+                  std::vector<int> &roomCells);
+  // Final room per label, -1 if culled
+  std::vector<int> cullSmallRooms(RoomSets &rooms,
+                                  const std::vector<int> &roomCells);
+  std::vector<Cave::BorderWall> joinRooms(FILE *labelFile,
+                                          const std::vector<int> &roomOf);
+  bool writeRows(FILE *labelFile, const std::vector<int> &roomOf,
+                 const std::vector<Cave::BorderWall> &mst, RowSink &sink);
+  // A row of labels (-1 for wall) to/from the runs in the temp file
+  void writeLabelRow(const int *labels, std::vector<uint8_t> &out) const;
+  bool readRow(FILE *labelFile, std::vector<int> &labels);
+  void reject(Rejection rejection);
+
+  CaveInfo mInfo;
+  GenerationParams mParams;
+  int mBandRows;
+  const CancelToken *mCancel = nullptr;
+  Cave mCave;
+  GenerationStats mStats;
+};
+
+} // namespace Cave
+
+#endif
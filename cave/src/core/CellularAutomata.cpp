@@ -0,0 +1,246 @@
+#include <algorithm>
+#include <cstring>
+
+#include "CellularAutomata.h"
+
+#include "Debug.h"
+
+namespace Cave {
+
+CellularAutomata::CellularAutomata(int width, int height, GridLayout layout)
+    : mWidth(width), mHeight(height), mLayout(layout),
+      mStride(width + 2 * PAD),
+      mTilesAcross((width + 2 * PAD + TILE - 1) / TILE),
+      mTilesDown((height + 2 * PAD + TILE - 1) / TILE),
+      mCur((layout == ROW_MAJOR) ? mStride * (height + 2 * PAD)
+                                 : mTilesAcross * mTilesDown * TILE * TILE,
+           1),
+      mNext(mCur), mPrev(mCur), mCol3(mStride), mCol5(mStride) {}
+
+CellularAutomata::~CellularAutomata() {}
+
+StepStats CellularAutomata::runStep(const GenerationStep &step,
+                                    bool detectOscillation) {
+  StepStats stats;
+  for (int rep = 0; rep < step.reps; ++rep) {
+    if (isCancelled(mCancel))
+      break;
+    // Keep the grid from before the last rep (left in mNext by its swap)
+    // so the result of this rep can be compared to it
+    if (detectOscillation && rep > 0) {
+      mPrev.swap(mNext);
+    }
+    int changes = runRep(step);
+    stats.mChanges.push_back(changes);
+    stats.mRepsRun++;
+    if (changes == 0) {
+      stats.mConverged = true;
+      break;
+    }
+    if (detectOscillation && rep > 0 && sameInside(mCur, mPrev)) {
+      stats.mOscillating = true;
+      // It is now flipping between mCur and the input to this rep (mNext)
+      // so an odd number of reps left would end on mNext
+      if ((step.reps - 1 - rep) % 2 == 1) {
+        mCur.swap(mNext);
+      }
+      break;
+    }
+  }
+  LOG_INFO("CA STEP: reps: " << stats.mRepsRun << "/" << step.reps
+                             << " converged: " << stats.mConverged
+                             << " oscillating: " << stats.mOscillating);
+  return stats;
+}
+
+int CellularAutomata::runRep(const GenerationStep &step) {
+  if (step.radius > 0)
+    return runRepIntegral(step);
+  return (mLayout == TILED) ? runRepTiles(step) : runRepColumns(step);
+}
+
+//
+// Column sums of the 3 and 5 rows around each row make each count a
+// short horizontal sum.
+//
+int CellularAutomata::runRepColumns(const GenerationStep &step) {
+  int changes = 0;
+  for (int y = 0; y < mHeight; ++y) {
+    const uint8_t *r[5];
+    for (int i = 0; i < 5; ++i) {
+      r[i] = &mCur[(y + i) * mStride];
+    }
+    for (int x = 0; x < mStride; ++x) {
+      int c3 = r[1][x] + r[2][x] + r[3][x];
+      mCol3[x] = c3;
+      mCol5[x] = c3 + r[0][x] + r[4][x];
+    }
+    const uint8_t *in = &mCur[index(0, y)];
+    uint8_t *out = &mNext[index(0, y)];
+    for (int x = 0; x < mWidth; ++x) {
+      const int px = x + PAD;
+      const int self = in[x];
+      const int n3 = mCol3[px - 1] + mCol3[px] + mCol3[px + 1];
+      const int n5 = mCol5[px - 2] + mCol5[px - 1] + mCol5[px] +
+                     mCol5[px + 1] + mCol5[px + 2];
+      int wall;
+      if (self) {
+        wall = (n3 >= step.s3_min && n3 <= step.s3_max && n5 >= step.s5_min &&
+                n5 <= step.s5_max);
+      } else {
+        wall = (n3 >= step.b3_min && n3 <= step.b3_max && n5 >= step.b5_min &&
+                n5 <= step.b5_max);
+      }
+      out[x] = wall;
+      changes += (wall != self);
+    }
+  }
+  mCur.swap(mNext);
+  return changes;
+}
+
+//
+// Each tile is copied with the PAD cells round it (from at most 9 tiles) to
+// a patch, then counted with column sums as runRepColumns does.
+//
+int CellularAutomata::runRepTiles(const GenerationStep &step) {
+  const int P = TILE + 2 * PAD;
+  const int AREA = TILE * TILE;
+  uint8_t patch[P][P];
+  int col3[P];
+  int col5[P];
+  auto tileRow = [&](int tx, int ty, int row) -> const uint8_t * {
+    if (tx < 0 || ty < 0 || tx >= mTilesAcross || ty >= mTilesDown)
+      return nullptr;
+    return &mCur[(ty * mTilesAcross + tx) * AREA + row * TILE];
+  };
+
+  int changes = 0;
+  for (int ty = 0; ty < mTilesDown; ++ty) {
+    for (int tx = 0; tx < mTilesAcross; ++tx) {
+      // The inside (not padding) part of this tile
+      const int px0 = tx * TILE;
+      const int py0 = ty * TILE;
+      const int xBegin = std::max(px0, PAD) - px0;
+      const int xEnd = std::min(px0 + TILE, PAD + mWidth) - px0;
+      const int yBegin = std::max(py0, PAD) - py0;
+      const int yEnd = std::min(py0 + TILE, PAD + mHeight) - py0;
+      if (xBegin >= xEnd || yBegin >= yEnd)
+        continue;
+
+      for (int r = 0; r < P; ++r) {
+        const int py = py0 - PAD + r;
+        const int rowTy = (py < 0) ? -1 : py / TILE;
+        const int row = py - rowTy * TILE;
+        const uint8_t *left = tileRow(tx - 1, rowTy, row);
+        const uint8_t *mid = tileRow(tx, rowTy, row);
+        const uint8_t *right = tileRow(tx + 1, rowTy, row);
+        for (int c = 0; c < PAD; ++c) {
+          patch[r][c] = left ? left[TILE - PAD + c] : 1;
+          patch[r][PAD + TILE + c] = right ? right[c] : 1;
+        }
+        if (mid) {
+          std::memcpy(&patch[r][PAD], mid, TILE);
+        } else {
+          std::memset(&patch[r][PAD], 1, TILE);
+        }
+      }
+
+      uint8_t *out = &mNext[(ty * mTilesAcross + tx) * AREA];
+      for (int y = yBegin; y < yEnd; ++y) {
+        const int pr = y + PAD;
+        for (int c = 0; c < P; ++c) {
+          int c3 = patch[pr - 1][c] + patch[pr][c] + patch[pr + 1][c];
+          col3[c] = c3;
+          col5[c] = c3 + patch[pr - 2][c] + patch[pr + 2][c];
+        }
+        for (int x = xBegin; x < xEnd; ++x) {
+          const int pc = x + PAD;
+          const int self = patch[pr][pc];
+          const int n3 = col3[pc - 1] + col3[pc] + col3[pc + 1];
+          const int n5 = col5[pc - 2] + col5[pc - 1] + col5[pc] +
+                         col5[pc + 1] + col5[pc + 2];
+          int wall;
+          if (self) {
+            wall = (n3 >= step.s3_min && n3 <= step.s3_max &&
+                    n5 >= step.s5_min && n5 <= step.s5_max);
+          } else {
+            wall = (n3 >= step.b3_min && n3 <= step.b3_max &&
+                    n5 >= step.b5_min && n5 <= step.b5_max);
+          }
+          out[y * TILE + x] = wall;
+          changes += (wall != self);
+        }
+      }
+    }
+  }
+  mCur.swap(mNext);
+  return changes;
+}
+
+//
+// Everything off the grid is wall, so the walls in a square are its area
+// less the floors in the part that is on the grid.
+//
+int CellularAutomata::wallsAround(int x, int y, int r) const {
+  const int stride = mWidth + 1;
+  const int x0 = std::max(0, x - r);
+  const int y0 = std::max(0, y - r);
+  const int x1 = std::min(mWidth, x + r + 1);
+  const int y1 = std::min(mHeight, y + r + 1);
+  const int floors = mFloorSum[y1 * stride + x1] - mFloorSum[y0 * stride + x1] -
+                     mFloorSum[y1 * stride + x0] + mFloorSum[y0 * stride + x0];
+  const int side = 2 * r + 1;
+  return side * side - floors;
+}
+
+int CellularAutomata::runRepIntegral(const GenerationStep &step) {
+  const int stride = mWidth + 1;
+  mFloorSum.assign(stride * (mHeight + 1), 0);
+  for (int y = 0; y < mHeight; ++y) {
+    const int *above = &mFloorSum[y * stride];
+    int *sum = &mFloorSum[(y + 1) * stride];
+    int rowFloors = 0;
+    for (int x = 0; x < mWidth; ++x) {
+      rowFloors += 1 - mCur[index(x, y)];
+      sum[x + 1] = above[x + 1] + rowFloors;
+    }
+  }
+
+  int changes = 0;
+  for (int y = 0; y < mHeight; ++y) {
+    for (int x = 0; x < mWidth; ++x) {
+      const int i = index(x, y);
+      const int self = mCur[i];
+      const int n3 = wallsAround(x, y, 1);
+      const int n5 = wallsAround(x, y, 2);
+      const int nn = wallsAround(x, y, step.radius);
+      int wall;
+      if (self) {
+        wall = (n3 >= step.s3_min && n3 <= step.s3_max && n5 >= step.s5_min &&
+                n5 <= step.s5_max && nn >= step.sn_min && nn <= step.sn_max);
+      } else {
+        wall = (n3 >= step.b3_min && n3 <= step.b3_max && n5 >= step.b5_min &&
+                n5 <= step.b5_max && nn >= step.bn_min && nn <= step.bn_max);
+      }
+      mNext[i] = wall;
+      changes += (wall != self);
+    }
+  }
+  mCur.swap(mNext);
+  return changes;
+}
+
+bool CellularAutomata::sameInside(const std::vector<uint8_t> &a,
+                                  const std::vector<uint8_t> &b) const {
+  // The padding is always wall so whole tiles can be compared
+  if (mLayout == TILED)
+    return a == b;
+  for (int y = 0; y < mHeight; ++y) {
+    if (std::memcmp(&a[index(0, y)], &b[index(0, y)], mWidth) != 0)
+      return false;
+  }
+  return true;
+}
+
+} // namespace Cave
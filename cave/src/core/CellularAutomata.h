@@ -0,0 +1,94 @@
+#ifndef CELLULAR_AUTOMATA_H
+#define CELLULAR_AUTOMATA_H
+
+#include "CancelToken.h"
+#include "GenerationParams.h"
+#include "GenerationStats.h"
+#include <cstdint>
+#include <vector>
+
+namespace Cave {
+
+//
+// Life-like cellular automata where "alive" is WALL.
+//
+// The rule PCG::RogueCave used: for each cell n3 is the number of walls in
+// the 3x3 square centred on it and n5 the number in the 5x5 square, both
+// counting the cell itself (so 0..9 and 0..25). Anything off the grid
+// counts as wall. Each rep (all cells at once):
+// - a floor becomes wall if b3_min <= n3 <= b3_max and b5_min <= n5 <= b5_max
+// - a wall stays wall if s3_min <= n3 <= s3_max and s5_min <= n5 <= s5_max
+// e.g. b3 9..9 s3 2..9 removes single walls and fills nothing.
+//
+// A step with a radius also needs nn, the walls in the (2 * radius + 1)
+// square (again with the cell), to be in bn (floor) or sn (wall). All
+// three counts then come from an integral image of the floors made once
+// per rep, so any radius is O(1) per cell. Steps without one use running
+// column sums instead.
+//
+// The cells are either row major or in TILED 8x8 tiles (one cache line
+// each, the tiles row major), which keeps each cell's 5x5 in a few lines
+// however wide the map is. The tiled reps count from a copy of the tile
+// and the 2 cells round it.
+//
+// A step stops early once a rep changes nothing, and if detectOscillation is
+// set, once the grid repeats every 2 reps (the final state is then picked by
+// the parity of the reps left). Either way the result is exactly what
+// running every rep would give.
+//
+class CellularAutomata {
+public:
+  CellularAutomata(int width, int height, GridLayout layout = ROW_MAJOR);
+  ~CellularAutomata();
+
+  bool isWall(int x, int y) const { return mCur[index(x, y)] != 0; }
+  void setWall(int x, int y, bool wall) { mCur[index(x, y)] = wall ? 1 : 0; }
+
+  // Checked before each rep, runStep stops once it is cancelled
+  void setCancelToken(const CancelToken *token) { mCancel = token; }
+
+  StepStats runStep(const GenerationStep &step, bool detectOscillation);
+  // Returns the number of cells changed
+  int runRep(const GenerationStep &step);
+
+private:
+  int runRepColumns(const GenerationStep &step);
+  int runRepTiles(const GenerationStep &step);
+  int runRepIntegral(const GenerationStep &step);
+  // Walls in the square of radius r centred on x,y
+  int wallsAround(int x, int y, int r) const;
+
+  static constexpr int PAD = 2;
+  static constexpr int TILE = 8;
+  int index(int x, int y) const {
+    const int px = x + PAD;
+    const int py = y + PAD;
+    if (mLayout == ROW_MAJOR)
+      return py * mStride + px;
+    return ((py / TILE) * mTilesAcross + px / TILE) * TILE * TILE +
+           (py % TILE) * TILE + px % TILE;
+  }
+  bool sameInside(const std::vector<uint8_t> &a,
+                  const std::vector<uint8_t> &b) const;
+
+  int mWidth;
+  int mHeight;
+  GridLayout mLayout;
+  const CancelToken *mCancel = nullptr;
+  int mStride;
+  int mTilesAcross;
+  int mTilesDown;
+  // Padded by PAD walls on every side so the 5x5 never needs bounds checks
+  // (and out to whole tiles if TILED)
+  std::vector<uint8_t> mCur;
+  std::vector<uint8_t> mNext;
+  std::vector<uint8_t> mPrev;
+  std::vector<int> mCol3;
+  std::vector<int> mCol5;
+  // mFloorSum[y * (mWidth + 1) + x] = floors in [0,x) x [0,y)
+  std::vector<int> mFloorSum;
+};
+
+} // namespace Cave
+
+#endif
@@ -0,0 +1,234 @@
+#include "CollisionBuilder.h"
+#include "TileTypes.h"
+#include <vector>
+
+#include "Debug.h"
+
+namespace Cave {
+
+namespace {
+//
+// The solid part of each slope tile in a unit cell (y down). The 1/2 of a
+// 30/60 pair follow the CaveSmoother: the '1' tile is the thick end next to
+// the solid wall and the '2' tile is the thin end.
+//
+// a   b
+//  +-+
+//  | |     a,b,c,d = the solid corner (TL, TR, BR, BL)
+//  +-+
+// d   c
+//
+struct SlopeShape {
+  TileName tile;
+  std::vector<CollisionPoint> points;
+};
+
+const SlopeShape slopeShapes[] = {
+    {T45a, {{0, 0}, {1, 0}, {0, 1}}},
+    {T45b, {{0, 0}, {1, 0}, {1, 1}}},
+    {T45c, {{1, 0}, {1, 1}, {0, 1}}},
+    {T45d, {{0, 0}, {1, 1}, {0, 1}}},
+
+    {H30a1, {{0, 0}, {1, 0}, {1, 0.5f}, {0, 1}}},
+    {H30a2, {{0, 0}, {1, 0}, {0, 0.5f}}},
+    {H30b1, {{0, 0}, {1, 0}, {1, 1}, {0, 0.5f}}},
+    {H30b2, {{0, 0}, {1, 0}, {1, 0.5f}}},
+    {H30c1, {{0, 0.5f}, {1, 0}, {1, 1}, {0, 1}}},
+    {H30c2, {{0, 1}, {1, 0.5f}, {1, 1}}},
+    {H30d1, {{0, 0}, {1, 0.5f}, {1, 1}, {0, 1}}},
+    {H30d2, {{0, 0.5f}, {1, 1}, {0, 1}}},
+
+    {V60a1, {{0, 0}, {1, 0}, {0.5f, 1}, {0, 1}}},
+    {V60a2, {{0, 0}, {0.5f, 0}, {0, 1}}},
+    {V60b1, {{0, 0}, {1, 0}, {1, 1}, {0.5f, 1}}},
+    {V60b2, {{0.5f, 0}, {1, 0}, {1, 1}}},
+    {V60c1, {{0.5f, 0}, {1, 0}, {1, 1}, {0, 1}}},
+    {V60c2, {{1, 0}, {1, 1}, {0.5f, 1}}},
+    {V60d1, {{0, 0}, {0.5f, 0}, {1, 1}, {0, 1}}},
+    {V60d2, {{0, 0}, {0.5f, 1}, {0, 1}}},
+};
+
+//
+// A complete 30/60 pair is one triangle. Keyed on the '1' tile with the
+// offset to its '2' partner and the triangle relative to the '1' cell.
+//
+struct SlopePair {
+  TileName tile1;
+  TileName tile2;
+  int dx, dy;
+  CollisionPoint points[3];
+};
+
+const SlopePair slopePairs[] = {
+    {H30a1, H30a2, 1, 0, {{0, 0}, {2, 0}, {0, 1}}},
+    {H30b1, H30b2, -1, 0, {{-1, 0}, {1, 0}, {1, 1}}},
+    {H30c1, H30c2, -1, 0, {{1, 0}, {1, 1}, {-1, 1}}},
+    {H30d1, H30d2, 1, 0, {{0, 0}, {0, 1}, {2, 1}}},
+    {V60a1, V60a2, 0, 1, {{0, 0}, {1, 0}, {0, 2}}},
+    {V60b1, V60b2, 0, 1, {{0, 0}, {1, 0}, {1, 2}}},
+    {V60c1, V60c2, 0, -1, {{1, -1}, {1, 1}, {0, 1}}},
+    {V60d1, V60d2, 0, -1, {{0, -1}, {0, 1}, {1, 1}}},
+};
+
+// Tiles that fill the whole cell
+bool isSolid(int tile) {
+  return tile == WALL || tile == SINGLE || tile == END_N || tile == END_S ||
+         tile == END_E || tile == END_W;
+}
+
+} // namespace
+
+CollisionBuilder::CollisionBuilder(const TileMap &tm, const CaveInfo &i)
+    : tileMap(tm), info(i) {}
+
+CollisionBuilder::~CollisionBuilder() {}
+
+CollisionGeometry CollisionBuilder::build() {
+  CollisionGeometry geometry;
+  if (tileMap.empty())
+    return geometry;
+  mergeWalls(geometry);
+  addBorder(geometry);
+  addSlopes(geometry);
+  LOG_INFO("COLLISION: rects: " << geometry.mRects.size()
+                                << " polygons: " << geometry.mPolygons.size());
+  return geometry;
+}
+
+//
+// Greedy merge: take the first unused solid cell, extend it right as far as
+// possible then extend that span down while every cell in it is solid.
+// Only the cells inside the border ring, which is laid out differently.
+//
+void CollisionBuilder::mergeWalls(CollisionGeometry &geometry) {
+  const int H = tileMap.size();
+  const int W = tileMap[0].size();
+  std::vector<std::vector<bool>> used(H, std::vector<bool>(W, false));
+  auto isFree = [&](int x, int y) {
+    return isSolid(tileMap[y][x]) && !used[y][x];
+  };
+
+  for (int y = 1; y < H - 1; ++y) {
+    for (int x = 1; x < W - 1; ++x) {
+      if (!isFree(x, y))
+        continue;
+      int w = 1;
+      while (x + w < W - 1 && isFree(x + w, y)) {
+        ++w;
+      }
+      int h = 1;
+      bool spanSolid = true;
+      while (spanSolid && y + h < H - 1) {
+        for (int i = 0; i < w; ++i) {
+          if (!isFree(x + i, y + h)) {
+            spanSolid = false;
+            break;
+          }
+        }
+        if (spanSolid)
+          ++h;
+      }
+      for (int j = 0; j < h; ++j) {
+        for (int i = 0; i < w; ++i) {
+          used[y + j][x + i] = true;
+        }
+      }
+      geometry.mRects.push_back(
+          {info.mBorderWidth + x * info.mCellWidth,
+           info.mBorderHeight + y * info.mCellHeight, w * info.mCellWidth,
+           h * info.mCellHeight});
+    }
+  }
+}
+
+//
+// The border ring where GDCave puts it (for_each_tile): a side cell x,y
+// (corners included) is mBorderWidth tiles from tile x,y and a top or
+// bottom one mBorderHeight tiles down from tile x,y. Runs of solid cells
+// along each side are merged.
+//
+void CollisionBuilder::addBorder(CollisionGeometry &geometry) {
+  const int H = tileMap.size();
+  const int W = tileMap[0].size();
+  if (info.mBorderWidth > 0) {
+    for (int x : {0, W - 1}) {
+      for (int y = 0; y < H;) {
+        const int y0 = y;
+        while (y < H && isSolid(tileMap[y][x])) {
+          ++y;
+        }
+        if (y > y0) {
+          geometry.mRects.push_back({x, y0, info.mBorderWidth, y - y0});
+        } else {
+          ++y;
+        }
+      }
+    }
+  }
+  if (info.mBorderHeight > 0) {
+    for (int y : {0, H - 1}) {
+      for (int x = 1; x < W - 1;) {
+        const int x0 = x;
+        while (x < W - 1 && isSolid(tileMap[y][x])) {
+          ++x;
+        }
+        if (x > x0) {
+          geometry.mRects.push_back({x0, y, x - x0, info.mBorderHeight});
+        } else {
+          ++x;
+        }
+      }
+    }
+  }
+}
+
+void CollisionBuilder::addSlopes(CollisionGeometry &geometry) {
+  const int H = tileMap.size();
+  const int W = tileMap[0].size();
+  std::vector<std::vector<bool>> used(H, std::vector<bool>(W, false));
+  auto toTiles = [&](int x, int y, const CollisionPoint &p) {
+    return CollisionPoint{
+        info.mBorderWidth + (x + p.x) * info.mCellWidth,
+        info.mBorderHeight + (y + p.y) * info.mCellHeight};
+  };
+
+  // Complete pairs first so they become one triangle
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      for (const SlopePair &pair : slopePairs) {
+        if (tileMap[y][x] != pair.tile1)
+          continue;
+        int px = x + pair.dx;
+        int py = y + pair.dy;
+        if (px < 0 || px >= W || py < 0 || py >= H ||
+            tileMap[py][px] != pair.tile2 || used[py][px])
+          continue;
+        std::vector<CollisionPoint> poly;
+        for (const CollisionPoint &p : pair.points) {
+          poly.push_back(toTiles(x, y, p));
+        }
+        geometry.mPolygons.push_back(poly);
+        used[y][x] = true;
+        used[py][px] = true;
+      }
+    }
+  }
+  // Then the 45s and any half pairs
+  for (int y = 0; y < H; ++y) {
+    for (int x = 0; x < W; ++x) {
+      if (used[y][x])
+        continue;
+      for (const SlopeShape &shape : slopeShapes) {
+        if (tileMap[y][x] != shape.tile)
+          continue;
+        std::vector<CollisionPoint> poly;
+        for (const CollisionPoint &p : shape.points) {
+          poly.push_back(toTiles(x, y, p));
+        }
+        geometry.mPolygons.push_back(poly);
+      }
+    }
+  }
+}
+
+} // namespace Cave
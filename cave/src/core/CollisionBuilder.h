@@ -0,0 +1,56 @@
+#ifndef COLLISION_BUILDER_H
+#define COLLISION_BUILDER_H
+
+#include "CaveInfo.h"
+#include "TileTypes.h"
+#include <vector>
+
+namespace Cave {
+
+//
+// Positions are in TileMapLayer tiles (not pixels) using the same layout
+// as GDCave's for_each_tile i.e. TileMap cell mx,my inside the border ring
+// covers the tiles from
+//   mBorderWidth + mx * mCellWidth, mBorderHeight + my * mCellHeight
+// for mCellWidth x mCellHeight tiles. A ring cell on the left or right
+// covers mBorderWidth x 1 tiles from mx,my, and one on the top or bottom
+// 1 x mBorderHeight tiles from mx,my.
+//
+struct CollisionRect {
+  int mX = 0;
+  int mY = 0;
+  int mW = 0;
+  int mH = 0;
+};
+
+struct CollisionPoint {
+  float x = 0;
+  float y = 0;
+};
+
+struct CollisionGeometry {
+  // Solid walls merged into as few rectangles as the greedy merge finds
+  std::vector<CollisionRect> mRects;
+  // The slopes, one convex polygon per 45 tile or 30/60 tile pair
+  std::vector<std::vector<CollisionPoint>> mPolygons;
+};
+
+class CollisionBuilder {
+public:
+  CollisionBuilder(const TileMap &tm, const CaveInfo &i);
+  ~CollisionBuilder();
+
+  CollisionGeometry build();
+
+private:
+  void mergeWalls(CollisionGeometry &geometry);
+  void addBorder(CollisionGeometry &geometry);
+  void addSlopes(CollisionGeometry &geometry);
+
+  const TileMap &tileMap;
+  const CaveInfo &info;
+};
+
+} // namespace Cave
+
+#endif
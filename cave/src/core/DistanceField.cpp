@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <iterator>
+
+#include "Cave.h"
+#include "DistanceField.h"
+
+#include "Debug.h"
+
+namespace Cave {
+
+namespace {
+// Cost per FLOW_DIRS entry
+const int STEP_COST[8] = {
+    DistanceField::DIST_ORTHO, DistanceField::DIST_ORTHO,
+    DistanceField::DIST_ORTHO, DistanceField::DIST_ORTHO,
+    DistanceField::DIST_DIAG,  DistanceField::DIST_DIAG,
+    DistanceField::DIST_DIAG,  DistanceField::DIST_DIAG};
+// Dial's buckets only need to cover the largest step
+const int NUM_BUCKETS = DistanceField::DIST_DIAG + 1;
+} // namespace
+
+// N, E, S, W then NE, SE, SW, NW
+const Vector2i DistanceField::FLOW_DIRS[8] = {
+    {0, -1}, {1, 0}, {0, 1}, {-1, 0}, {1, -1}, {1, 1}, {-1, 1}, {-1, -1}};
+
+DistanceField::DistanceField(const TileMap &tileMap, const CaveInfo &info)
+    : mWidth(info.mCaveWidth), mHeight(info.mCaveHeight),
+      mFloor(mWidth * mHeight, 0), mDist(mWidth * mHeight, UNREACHABLE),
+      mOwner(mWidth * mHeight, -1) {
+  for (int cy = 0; cy < mHeight; ++cy) {
+    for (int cx = 0; cx < mWidth; ++cx) {
+      mFloor[cy * mWidth + cx] = Cave::isFloor(tileMap, cx, cy) ? 1 : 0;
+    }
+  }
+}
+
+DistanceField::~DistanceField() {}
+
+//
+// A diagonal step needs both the orthogonal cells open so the path
+// doesn't squeeze between two walls touching at a corner.
+//
+bool DistanceField::canStep(int x, int y, int dir) const {
+  const Vector2i &d = FLOW_DIRS[dir];
+  if (!isOpen(x + d.x, y + d.y))
+    return false;
+  if (dir >= 4) {
+    return isOpen(x + d.x, y) && isOpen(x, y + d.y);
+  }
+  return true;
+}
+
+void DistanceField::compute(const std::vector<Vector2i> &sources) {
+  std::fill(mDist.begin(), mDist.end(), UNREACHABLE);
+  std::fill(mOwner.begin(), mOwner.end(), -1);
+  mSources.clear();
+  std::vector<std::pair<int, int>> seeds;
+  for (const Vector2i &src : sources) {
+    if (!isOpen(src.x, src.y))
+      continue;
+    int idx = src.y * mWidth + src.x;
+    if (mDist[idx] == 0)
+      continue;
+    mDist[idx] = 0;
+    mOwner[idx] = idx;
+    mSources.push_back(idx);
+    seeds.push_back({0, idx});
+  }
+  propagate(seeds);
+  LOG_INFO("DISTANCE FIELD: sources: " << mSources.size());
+}
+
+//
+// Removing a source invalidates every cell it owned. Those are reset and
+// re-seeded from their neighbours that are still valid, along with the new
+// sources. Cells owned by unchanged sources are never touched unless a new
+// source is now closer.
+//
+void DistanceField::updateSources(const std::vector<Vector2i> &sources) {
+  std::vector<int> newSources;
+  for (const Vector2i &src : sources) {
+    if (isOpen(src.x, src.y)) {
+      newSources.push_back(src.y * mWidth + src.x);
+    }
+  }
+  std::sort(newSources.begin(), newSources.end());
+  newSources.erase(std::unique(newSources.begin(), newSources.end()),
+                   newSources.end());
+  std::vector<int> oldSources = mSources;
+  std::sort(oldSources.begin(), oldSources.end());
+
+  std::vector<int> removed;
+  std::vector<int> added;
+  std::set_difference(oldSources.begin(), oldSources.end(),
+                      newSources.begin(), newSources.end(),
+                      std::back_inserter(removed));
+  std::set_difference(newSources.begin(), newSources.end(),
+                      oldSources.begin(), oldSources.end(),
+                      std::back_inserter(added));
+  if (removed.empty() && added.empty())
+    return;
+
+  std::vector<std::pair<int, int>> seeds;
+  if (!removed.empty()) {
+    std::vector<uint8_t> isRemoved(mWidth * mHeight, 0);
+    for (int idx : removed) {
+      isRemoved[idx] = 1;
+    }
+    std::vector<int> reset;
+    for (int idx = 0; idx < (int)mOwner.size(); ++idx) {
+      if (mOwner[idx] >= 0 && isRemoved[mOwner[idx]]) {
+        mDist[idx] = UNREACHABLE;
+        mOwner[idx] = -1;
+        reset.push_back(idx);
+      }
+    }
+    for (int idx : reset) {
+      int x = idx % mWidth;
+      int y = idx / mWidth;
+      for (int dir = 0; dir < 8; ++dir) {
+        if (!canStep(x, y, dir))
+          continue;
+        int n = (y + FLOW_DIRS[dir].y) * mWidth + (x + FLOW_DIRS[dir].x);
+        if (mDist[n] != UNREACHABLE) {
+          seeds.push_back({mDist[n], n});
+        }
+      }
+    }
+    mSources.erase(std::remove_if(mSources.begin(), mSources.end(),
+                                  [&](int idx) { return isRemoved[idx]; }),
+                   mSources.end());
+  }
+  for (int idx : added) {
+    mDist[idx] = 0;
+    mOwner[idx] = idx;
+    mSources.push_back(idx);
+    seeds.push_back({0, idx});
+  }
+  std::sort(seeds.begin(), seeds.end());
+  seeds.erase(std::unique(seeds.begin(), seeds.end()), seeds.end());
+  propagate(seeds);
+  LOG_INFO("DISTANCE FIELD UPDATE: removed: " << removed.size()
+                                              << " added: " << added.size());
+}
+
+//
+// Dial's algorithm: the step costs are small ints so a ring of buckets
+// indexed by distance replaces the priority queue. The seeds (sorted by
+// distance) can be anywhere in the distance range so each is dropped into
+// the ring when the wavefront reaches its distance. A cell is only relaxed
+// if it improves, so this works for both a fresh field and for lowering an
+// existing one.
+//
+void DistanceField::propagate(const std::vector<std::pair<int, int>> &seeds) {
+  if (seeds.empty())
+    return;
+  std::vector<std::vector<int>> buckets(NUM_BUCKETS);
+  size_t nextSeed = 0;
+  int pending = 0;
+  int dist = seeds[0].first;
+  while (pending > 0 || nextSeed < seeds.size()) {
+    if (pending == 0) {
+      dist = std::max(dist, seeds[nextSeed].first);
+    }
+    while (nextSeed < seeds.size() && seeds[nextSeed].first == dist) {
+      buckets[dist % NUM_BUCKETS].push_back(seeds[nextSeed].second);
+      ++pending;
+      ++nextSeed;
+    }
+    std::vector<int> &bucket = buckets[dist % NUM_BUCKETS];
+    while (!bucket.empty()) {
+      int idx = bucket.back();
+      bucket.pop_back();
+      --pending;
+      if (mDist[idx] != dist)
+        continue;
+      int x = idx % mWidth;
+      int y = idx / mWidth;
+      for (int dir = 0; dir < 8; ++dir) {
+        if (!canStep(x, y, dir))
+          continue;
+        int n = (y + FLOW_DIRS[dir].y) * mWidth + (x + FLOW_DIRS[dir].x);
+        int nd = dist + STEP_COST[dir];
+        if (mDist[n] == UNREACHABLE || nd < mDist[n]) {
+          mDist[n] = nd;
+          mOwner[n] = mOwner[idx];
+          buckets[nd % NUM_BUCKETS].push_back(n);
+          ++pending;
+        }
+      }
+    }
+    ++dist;
+  }
+}
+
+std::vector<uint8_t> DistanceField::getFlowField() const {
+  std::vector<uint8_t> flow(mWidth * mHeight, NO_FLOW);
+  for (int y = 0; y < mHeight; ++y) {
+    for (int x = 0; x < mWidth; ++x) {
+      int idx = y * mWidth + x;
+      int best = mDist[idx];
+      if (best == UNREACHABLE || best == 0)
+        continue;
+      for (int dir = 0; dir < 8; ++dir) {
+        if (!canStep(x, y, dir))
+          continue;
+        int d = mDist[(y + FLOW_DIRS[dir].y) * mWidth + (x + FLOW_DIRS[dir].x)];
+        if (d != UNREACHABLE && d < best) {
+          best = d;
+          flow[idx] = dir;
+        }
+      }
+    }
+  }
+  return flow;
+}
+
+//
+// Two pass chamfer transform. Anything off the map counts as wall.
+//
+std::vector<int> DistanceField::getWallDistances() const {
+  const int BIG = (mWidth + mHeight) * DIST_DIAG;
+  std::vector<int> dist(mWidth * mHeight);
+  auto at = [&](int x, int y) {
+    if (x < 0 || x >= mWidth || y < 0 || y >= mHeight)
+      return 0;
+    return dist[y * mWidth + x];
+  };
+  for (int y = 0; y < mHeight; ++y) {
+    for (int x = 0; x < mWidth; ++x) {
+      int idx = y * mWidth + x;
+      if (!mFloor[idx]) {
+        dist[idx] = 0;
+        continue;
+      }
+      int d = BIG;
+      d = std::min(d, at(x - 1, y) + DIST_ORTHO);
+      d = std::min(d, at(x, y - 1) + DIST_ORTHO);
+      d = std::min(d, at(x - 1, y - 1) + DIST_DIAG);
+      d = std::min(d, at(x + 1, y - 1) + DIST_DIAG);
+      dist[idx] = d;
+    }
+  }
+  for (int y = mHeight - 1; y >= 0; --y) {
+    for (int x = mWidth - 1; x >= 0; --x) {
+      int idx = y * mWidth + x;
+      if (!mFloor[idx])
+        continue;
+      int d = dist[idx];
+      d = std::min(d, at(x + 1, y) + DIST_ORTHO);
+      d = std::min(d, at(x, y + 1) + DIST_ORTHO);
+      d = std::min(d, at(x + 1, y + 1) + DIST_DIAG);
+      d = std::min(d, at(x - 1, y + 1) + DIST_DIAG);
+      dist[idx] = d;
+    }
+  }
+  return dist;
+}
+
+} // namespace Cave
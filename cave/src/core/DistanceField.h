@@ -0,0 +1,68 @@
+#ifndef DISTANCE_FIELD_H
+#define DISTANCE_FIELD_H
+
+#include "CaveInfo.h"
+#include "TileTypes.h"
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace Cave {
+
+//
+// Chamfer (3-4) distance fields over the FLOOR cells of a generated cave.
+// A straight step costs DIST_ORTHO and a diagonal step DIST_DIAG, so
+// divide by DIST_ORTHO for an approximate distance in cells. Diagonal steps
+// aren't allowed to cut a wall corner.
+//
+// All arrays are cave width x height, row major, in cave cell coords
+// (i.e. without the TileMap border).
+//
+class DistanceField {
+public:
+  static constexpr int DIST_ORTHO = 3;
+  static constexpr int DIST_DIAG = 4;
+  static constexpr int UNREACHABLE = -1;
+  static constexpr uint8_t NO_FLOW = 0xFF;
+
+  DistanceField(const TileMap &tileMap, const CaveInfo &info);
+  ~DistanceField();
+
+  // Multi-source distance from the given cells (non-floor ones are ignored)
+  void compute(const std::vector<Vector2i> &sources);
+  // Change the sources and only redo the cells that are affected by the
+  // sources that were removed or added.
+  void updateSources(const std::vector<Vector2i> &sources);
+
+  const std::vector<int> &getDistances() const { return mDist; }
+  // Per cell index 0..7 of the neighbour to step to (see FLOW_DIRS) to get
+  // closer to a source, NO_FLOW for sources, walls and unreachable cells.
+  std::vector<uint8_t> getFlowField() const;
+  // Distance from each floor cell to the nearest non-floor cell (0 = wall)
+  std::vector<int> getWallDistances() const;
+
+  int getWidth() const { return mWidth; }
+  int getHeight() const { return mHeight; }
+
+  static const Vector2i FLOW_DIRS[8];
+
+private:
+  void propagate(const std::vector<std::pair<int, int>> &seeds);
+  bool canStep(int x, int y, int dir) const;
+  bool isOpen(int x, int y) const {
+    return x >= 0 && x < mWidth && y >= 0 && y < mHeight &&
+           mFloor[y * mWidth + x];
+  }
+
+  int mWidth;
+  int mHeight;
+  std::vector<uint8_t> mFloor;
+  std::vector<int> mDist;
+  // Cell index of the source each cell's distance came from
+  std::vector<int> mOwner;
+  std::vector<int> mSources;
+};
+
+} // namespace Cave
+
+#endif
@@ -5,12 +5,40 @@
 
 namespace Cave {
 
+// How the CA holds its cells (see CellularAutomata)
+enum GridLayout {
+    ROW_MAJOR,
+    // 8x8 tiles of a cache line each
+    TILED
+};
+
 struct GenerationStep {
     int b3_min, b3_max;
     int b5_min, b5_max;
     int s3_min, s3_max;
     int s5_min, s5_max;
     int reps;
+    // Optional count over the (2 * radius + 1) square round the cell e.g.
+    // radius 3 = 7x7, checked the same way as the 3x3 and 5x5 (0 = unused)
+    int radius = 0;
+    int bn_min = 0, bn_max = 0;
+    int sn_min = 0, sn_max = 0;
+};
+
+//
+// Limits a cave has to meet. Each is checked as soon as the stage it
+// depends on is done and generation stops there if it fails.
+// A max < 0 means no limit.
+//
+struct AcceptanceCriteria {
+    // Fraction of cave cells that are floor after the CA
+    float mMinFloorRatio = 0;
+    float mMaxFloorRatio = 1;
+    // Rooms found before joining
+    int mMinRooms = 0;
+    int mMaxRooms = -1;
+    // Tunnels dug to join the rooms
+    int mMaxTunnels = -1;
 };
 
 struct GenerationParams {
@@ -21,6 +49,21 @@ struct GenerationParams {
     float mFreq = 1;
     float mAmp = 1;
     std::vector<GenerationStep> mGenerations;
+    // Also stop a step when it flips between 2 states (same result)
+    bool mDetectOscillation = true;
+    // Same result either way, just speed
+    GridLayout mGridLayout = ROW_MAJOR;
+    // Worker threads for the parallel stages (0 = all cores, 1 = serial)
+    int mThreads = 0;
+    // Rooms with fewer cells are filled in before joining (0 = keep all)
+    int mMinRoomSize = 0;
+    // Coarse to fine: if > 1 the noise and mGenerations are done on a grid
+    // this many times smaller, scaled back up and then finished off with
+    // mRefineGenerations at full size
+    int mPyramidScale = 1;
+    // Empty = 2 reps of a majority vote to round off the scaled up blocks
+    std::vector<GenerationStep> mRefineGenerations;
+    AcceptanceCriteria mAccept;
 };
 
 }
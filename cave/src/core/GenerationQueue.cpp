@@ -0,0 +1,166 @@
+#include "GenerationQueue.h"
+#include "Cave.h"
+#include "Parallel.h"
+#include "Trace.h"
+#include <algorithm>
+
+#include "Debug.h"
+
+namespace Cave {
+
+GenerationQueue::GenerationQueue(int workers, size_t maxBytes)
+    : mMaxBytes(maxBytes) {
+  const int count = std::max(1, resolveThreads(workers));
+  for (int i = 0; i < count; ++i) {
+    mWorkers.emplace_back(&GenerationQueue::work, this);
+  }
+}
+
+GenerationQueue::~GenerationQueue() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStop = true;
+    mQueued.clear();
+  }
+  mCancel.cancel();
+  mWake.notify_all();
+  for (std::thread &worker : mWorkers) {
+    worker.join();
+  }
+}
+
+uint64_t GenerationQueue::enqueue(const CaveInfo &info,
+                                  const GenerationParams &params,
+                                  bool withRoomGraph, int priority) {
+  const uint64_t key = CaveCache::makeKey(info, params);
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = std::find_if(mQueued.begin(), mQueued.end(),
+                           [&](const Job &job) { return job.mKey == key; });
+    if (it != mQueued.end()) {
+      it->mPriority = priority;
+      it->mRoomGraph = it->mRoomGraph || withRoomGraph;
+      return key;
+    }
+    // Already made (or being made) with what is wanted
+    auto done = mDone.find(key);
+    if (mRunning.count(key) ||
+        (done != mDone.end() &&
+         (!withRoomGraph || done->second.mHasRoomGraph))) {
+      return key;
+    }
+    mQueued.push_back(
+        {key, info, params, withRoomGraph, priority, mNextOrder++});
+  }
+  mWake.notify_one();
+  return key;
+}
+
+bool GenerationQueue::take(uint64_t key, bool needRoomGraph,
+                           CachedCave &cave) {
+  std::unique_lock<std::mutex> lock(mMutex);
+  auto it = std::find_if(mQueued.begin(), mQueued.end(),
+                         [&](const Job &job) { return job.mKey == key; });
+  if (it != mQueued.end()) {
+    mQueued.erase(it);
+    return false;
+  }
+  mFinished.wait(lock, [&] { return mRunning.count(key) == 0; });
+  auto done = mDone.find(key);
+  if (done == mDone.end() || (needRoomGraph && !done->second.mHasRoomGraph)) {
+    return false;
+  }
+  mDoneBytes -= CaveCache::sizeOf(done->second);
+  cave = std::move(done->second);
+  mDone.erase(done);
+  lock.unlock();
+  mWake.notify_all();
+  return true;
+}
+
+void GenerationQueue::cancel() {
+  std::unique_lock<std::mutex> lock(mMutex);
+  mQueued.clear();
+  mCancel.cancel();
+  mFinished.wait(lock, [&] { return mRunning.empty(); });
+  mCancel.reset();
+}
+
+QueueStats GenerationQueue::getStats() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  QueueStats stats;
+  stats.mQueued = mQueued.size();
+  stats.mRunning = mRunning.size();
+  stats.mFinished = mDone.size();
+  stats.mBytes = mDoneBytes;
+  return stats;
+}
+
+// Caller holds mMutex. Always lets one job run when nothing else is held
+// so a cap smaller than a cave doesn't stop everything.
+bool GenerationQueue::canStart() const {
+  if (mQueued.empty())
+    return false;
+  const size_t held = mDoneBytes + mRunningBytes;
+  return held == 0 || held < mMaxBytes;
+}
+
+size_t GenerationQueue::runningBytes(const CaveInfo &info) {
+  const size_t tiles =
+      (size_t)(info.mCaveWidth + 2) * (size_t)(info.mCaveHeight + 2);
+  return tiles * (2 * sizeof(int) + 3);
+}
+
+void GenerationQueue::work() {
+  std::unique_lock<std::mutex> lock(mMutex);
+  while (true) {
+    mWake.wait(lock, [&] { return mStop || canStart(); });
+    if (mStop)
+      return;
+    // Highest priority, then oldest
+    auto best = std::min_element(
+        mQueued.begin(), mQueued.end(), [](const Job &a, const Job &b) {
+          return (a.mPriority != b.mPriority) ? a.mPriority > b.mPriority
+                                              : a.mOrder < b.mOrder;
+        });
+    Job job = std::move(*best);
+    mQueued.erase(best);
+    const size_t reserved = runningBytes(job.mInfo);
+    mRunning[job.mKey] = reserved;
+    mRunningBytes += reserved;
+    lock.unlock();
+
+    job.mParams.mThreads = 1;
+    TraceScope trace("queue_job");
+    CachedCave cave;
+    cave.mHasRoomGraph = job.mRoomGraph;
+    Cave generator(job.mInfo, job.mParams);
+    generator.setCancelToken(&mCancel);
+    cave.mTileMap =
+        generator.generate(job.mRoomGraph ? &cave.mRoomGraph : nullptr);
+    cave.mStats = generator.getStats();
+    LOG_INFO("QUEUE: generated " << job.mKey << " rejection "
+                                 << cave.mStats.mRejection);
+
+    lock.lock();
+    mRunning.erase(job.mKey);
+    mRunningBytes -= reserved;
+    if (cave.mStats.mRejection == CANCELLED) {
+      mFinished.notify_all();
+      mWake.notify_all();
+      continue;
+    }
+    auto old = mDone.find(job.mKey);
+    if (old != mDone.end()) {
+      // Made again to add the room graph
+      mDoneBytes -= CaveCache::sizeOf(old->second);
+    }
+    mDoneBytes += CaveCache::sizeOf(cave);
+    mDone[job.mKey] = std::move(cave);
+    mFinished.notify_all();
+    // Less is held now, another worker may be able to start
+    mWake.notify_all();
+  }
+}
+
+} // namespace Cave
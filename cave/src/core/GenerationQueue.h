@@ -0,0 +1,88 @@
+#ifndef GENERATION_QUEUE_H
+#define GENERATION_QUEUE_H
+
+#include "CancelToken.h"
+#include "CaveCache.h"
+#include "CaveInfo.h"
+#include "GenerationParams.h"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace Cave {
+
+struct QueueStats {
+  int mQueued = 0;
+  int mRunning = 0;
+  int mFinished = 0;
+  // Held by the finished caves (CaveCache::sizeOf)
+  size_t mBytes = 0;
+};
+
+//
+// Generates caves ahead of time on worker threads. Jobs are keyed by
+// CaveCache::makeKey and run highest priority first (then in the order
+// they were added). Each job runs its stages serially (mThreads = 1) so
+// the workers only ever take a core each.
+//
+// Workers don't start another job while the finished caves and the jobs
+// running would be over maxBytes; take() frees the space again.
+//
+class GenerationQueue {
+public:
+  GenerationQueue(int workers, size_t maxBytes);
+  // The queued jobs are dropped and the running ones cancelled
+  ~GenerationQueue();
+
+  // Returns the key. Adding a key already queued just changes its priority.
+  uint64_t enqueue(const CaveInfo &info, const GenerationParams &params,
+                   bool withRoomGraph, int priority);
+
+  // The finished cave for key, waiting for it if it is running. A queued
+  // job is removed and false returned (so the caller generates it now).
+  bool take(uint64_t key, bool needRoomGraph, CachedCave &cave);
+
+  // Drop the queued jobs and cancel the running ones, returning once they
+  // have stopped. The finished caves are kept.
+  void cancel();
+
+  QueueStats getStats() const;
+
+private:
+  struct Job {
+    uint64_t mKey;
+    CaveInfo mInfo;
+    GenerationParams mParams;
+    bool mRoomGraph;
+    int mPriority;
+    uint64_t mOrder;
+  };
+
+  void work();
+  bool canStart() const;
+  // The map plus the CA and labelling buffers, roughly
+  static size_t runningBytes(const CaveInfo &info);
+
+  size_t mMaxBytes;
+  mutable std::mutex mMutex;
+  std::condition_variable mWake;
+  std::condition_variable mFinished;
+  bool mStop = false;
+  CancelToken mCancel;
+  uint64_t mNextOrder = 0;
+  std::vector<Job> mQueued;
+  // key -> bytes reserved for it
+  std::unordered_map<uint64_t, size_t> mRunning;
+  size_t mRunningBytes = 0;
+  std::unordered_map<uint64_t, CachedCave> mDone;
+  size_t mDoneBytes = 0;
+  std::vector<std::thread> mWorkers;
+};
+
+} // namespace Cave
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef GENERATION_STATS_H
+#define GENERATION_STATS_H
+
+#include <vector>
+
+namespace Cave {
+
+// What happened to one GenerationStep
+struct StepStats {
+  // Reps actually run, can be less than GenerationStep::reps
+  int mRepsRun = 0;
+  // Stopped because a rep changed nothing
+  bool mConverged = false;
+  // Stopped because the grid was flipping between two states
+  bool mOscillating = false;
+  // Cells changed by each rep that was run
+  std::vector<int> mChanges;
+};
+
+enum Rejection {
+  ACCEPTED,
+  REJECT_FLOOR_RATIO,
+  REJECT_ROOM_COUNT,
+  REJECT_TUNNEL_COUNT,
+  // Stopped by a CancelToken
+  CANCELLED,
+  // Couldn't be generated (see the log), e.g. CaveStreamer's temp file
+  // failed or its params aren't supported
+  FAILED
+};
+
+// Parts of generate that are timed
+enum Stage {
+  STAGE_NOISE,
+  // With mPyramidScale > 1 this includes the noise
+  STAGE_CA,
+  STAGE_FIXUP,
+  // Finding and culling them
+  STAGE_ROOMS,
+  // Digging the tunnels and the room graph
+  STAGE_JOIN,
+  STAGE_SMOOTH,
+  STAGE_COUNT
+};
+
+struct GenerationStats {
+  std::vector<StepStats> mSteps;
+  // Milliseconds, 0 for the stages not reached
+  float mStageMs[STAGE_COUNT] = {};
+  Rejection mRejection = ACCEPTED;
+  // Filled in as the stages run (so may be unset if rejected early)
+  float mFloorRatio = 0;
+  int mRoomCount = 0;
+  int mTunnelCount = 0;
+
+  void clear() { *this = GenerationStats(); }
+};
+
+} // namespace Cave
+
+#endif
@@ -0,0 +1,193 @@
+#include "LayerGenerator.h"
+#include "Parallel.h"
+#include "Trace.h"
+#include <algorithm>
+
+#include "Debug.h"
+
+namespace Cave {
+
+namespace {
+
+// Everything that goes into the noise and how the steps are run
+bool sameNoise(const GenerationParams &a, const GenerationParams &b) {
+  return a.seed == b.seed && a.mOctaves == b.mOctaves &&
+         a.mPerlin == b.mPerlin && a.mWallChance == b.mWallChance &&
+         a.mFreq == b.mFreq && a.mAmp == b.mAmp &&
+         a.mDetectOscillation == b.mDetectOscillation &&
+         a.mGridLayout == b.mGridLayout;
+}
+
+bool sameStep(const GenerationStep &a, const GenerationStep &b) {
+  return a.b3_min == b.b3_min && a.b3_max == b.b3_max &&
+         a.b5_min == b.b5_min && a.b5_max == b.b5_max &&
+         a.s3_min == b.s3_min && a.s3_max == b.s3_max &&
+         a.s5_min == b.s5_min && a.s5_max == b.s5_max && a.reps == b.reps &&
+         a.radius == b.radius && a.bn_min == b.bn_min &&
+         a.bn_max == b.bn_max && a.sn_min == b.sn_min && a.sn_max == b.sn_max;
+}
+
+} // namespace
+
+LayerGenerator::LayerGenerator(const CaveInfo &info,
+                               const std::vector<GenerationParams> &layers)
+    : mInfo(info), mLayers(layers) {
+  // The layers run side by side, so split the cores between them
+  const int threads =
+      std::max(1, resolveThreads(0) / std::max(1, (int)layers.size()));
+  for (GenerationParams &params : mLayers) {
+    if (params.mThreads == 0 && mLayers.size() > 1) {
+      params.mThreads = threads;
+    }
+  }
+}
+
+std::vector<TileMap>
+LayerGenerator::generate(std::vector<RoomGraph> *pRoomGraphs) {
+  TraceScope trace("layers");
+  const int count = mLayers.size();
+  mTileMaps.assign(count, TileMap());
+  mStats.assign(count, GenerationStats());
+  mSharedSteps = 0;
+  std::fill(mStageMs, mStageMs + STAGE_COUNT, 0.0f);
+  mRoomGraphs = pRoomGraphs;
+  if (mRoomGraphs) {
+    mRoomGraphs->assign(count, RoomGraph());
+  }
+
+  // Layers with the same noise, the pyramid ones on their own
+  std::vector<std::vector<int>> groups;
+  for (int layer = 0; layer < count; ++layer) {
+    const GenerationParams &params = mLayers[layer];
+    auto group = std::find_if(
+        groups.begin(), groups.end(), [&](const std::vector<int> &g) {
+          const GenerationParams &first = mLayers[g[0]];
+          return params.mPyramidScale <= 1 && first.mPyramidScale <= 1 &&
+                 sameNoise(params, first);
+        });
+    if (group == groups.end()) {
+      groups.push_back({layer});
+    } else {
+      group->push_back(layer);
+    }
+  }
+  parallelFor(groups.size(), [&](int g) {
+    runGroup(groups[g], 0, nullptr, GenerationStats());
+  });
+  LOG_INFO("LAYERS: " << count << " in " << groups.size()
+                      << " noise groups, shared steps: " << mSharedSteps);
+
+  mRoomGraphs = nullptr;
+  return std::move(mTileMaps);
+}
+
+void LayerGenerator::runGroup(const std::vector<int> &group, int depth,
+                              const std::vector<uint8_t> *cells,
+                              const GenerationStats &shared) {
+  if (group.size() == 1) {
+    finishLayer(group[0], depth, cells, shared);
+    return;
+  }
+  std::vector<uint8_t> noise;
+  GenerationStats withNoise;
+  if (!cells) {
+    Cave cave(mInfo, mLayers[group[0]]);
+    cave.setCancelToken(mCancel);
+    noise = cave.runSteps(0);
+    if (isCancelled(mCancel)) {
+      for (int layer : group) {
+        mStats[layer].mRejection = CANCELLED;
+      }
+      return;
+    }
+    addStageMs(cave.getStats());
+    withNoise = cave.getStats();
+    cells = &noise;
+  } else {
+    withNoise = shared;
+  }
+
+  // Split on the next step. The layers that have none left are done.
+  std::vector<std::vector<int>> branches;
+  for (int layer : group) {
+    const std::vector<GenerationStep> &gens = mLayers[layer].mGenerations;
+    auto branch = std::find_if(
+        branches.begin(), branches.end(), [&](const std::vector<int> &b) {
+          const std::vector<GenerationStep> &other =
+              mLayers[b[0]].mGenerations;
+          if ((int)gens.size() == depth || (int)other.size() == depth)
+            return false;
+          return sameStep(gens[depth], other[depth]);
+        });
+    if (branch == branches.end()) {
+      branches.push_back({layer});
+    } else {
+      branch->push_back(layer);
+    }
+  }
+
+  parallelFor(branches.size(), [&](int b) {
+    const std::vector<int> &branch = branches[b];
+    if (branch.size() == 1) {
+      finishLayer(branch[0], depth, cells, withNoise);
+      return;
+    }
+    // The step they all have next, run once
+    Cave cave(mInfo, mLayers[branch[0]]);
+    cave.setCancelToken(mCancel);
+    std::vector<uint8_t> next = cave.runSteps(depth + 1, cells, depth);
+    if (isCancelled(mCancel)) {
+      for (int layer : branch) {
+        mStats[layer].mRejection = CANCELLED;
+      }
+      return;
+    }
+    mSharedSteps += branch.size() - 1;
+    addStageMs(cave.getStats());
+    GenerationStats nextShared = withNoise;
+    const GenerationStats &ran = cave.getStats();
+    nextShared.mSteps.insert(nextShared.mSteps.end(), ran.mSteps.begin(),
+                             ran.mSteps.end());
+    nextShared.mStageMs[STAGE_CA] += ran.mStageMs[STAGE_CA];
+    runGroup(branch, depth + 1, &next, nextShared);
+  });
+}
+
+void LayerGenerator::finishLayer(int layer, int depth,
+                                 const std::vector<uint8_t> *cells,
+                                 const GenerationStats &shared) {
+  TraceScope trace("layer", layer);
+  const GenerationParams &params = mLayers[layer];
+  RoomGraph *pRoomGraph = mRoomGraphs ? &(*mRoomGraphs)[layer] : nullptr;
+  Cave cave(mInfo, params);
+  cave.setCancelToken(mCancel);
+  if (params.mPyramidScale > 1) {
+    mTileMaps[layer] = cave.generate(pRoomGraph);
+    mStats[layer] = cave.getStats();
+    addStageMs(mStats[layer]);
+    return;
+  }
+  std::vector<uint8_t> own =
+      cave.runSteps(params.mGenerations.size(), cells, depth);
+  if (isCancelled(mCancel)) {
+    mStats[layer].mRejection = CANCELLED;
+    return;
+  }
+  mTileMaps[layer] = cave.generateFrom(own, pRoomGraph);
+  GenerationStats stats = cave.getStats();
+  addStageMs(stats);
+  stats.mSteps.insert(stats.mSteps.begin(), shared.mSteps.begin(),
+                      shared.mSteps.end());
+  stats.mStageMs[STAGE_NOISE] += shared.mStageMs[STAGE_NOISE];
+  stats.mStageMs[STAGE_CA] += shared.mStageMs[STAGE_CA];
+  mStats[layer] = std::move(stats);
+}
+
+void LayerGenerator::addStageMs(const GenerationStats &stats) {
+  std::lock_guard<std::mutex> lock(mStageMutex);
+  for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+    mStageMs[stage] += stats.mStageMs[stage];
+  }
+}
+
+} // namespace Cave
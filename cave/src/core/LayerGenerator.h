@@ -0,0 +1,75 @@
+#ifndef LAYER_GENERATOR_H
+#define LAYER_GENERATOR_H
+
+#include "CancelToken.h"
+#include "Cave.h"
+#include "CaveInfo.h"
+#include "GenerationParams.h"
+#include "GenerationStats.h"
+#include "RoomGraph.h"
+#include "TileTypes.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace Cave {
+
+//
+// Generates several layers of the same size in one go (e.g. background
+// rock, the main cave and foreground overhangs), each with its own params.
+//
+// Layers with the same noise (seed, octaves, wall chance ...) share the
+// noise fill and the CA of the steps at the start of mGenerations they have
+// in common, then each carries on by itself (Cave::runSteps/generateFrom).
+// Branches that no longer share anything run on their own threads. Each
+// result is the same as Cave::generate for that layer's params, and so are
+// its stats: the shared noise and CA time is in the stats of every layer
+// that shared it (getStageMs has it once).
+//
+// Layers with mPyramidScale > 1 are just generated, alongside the rest.
+//
+class LayerGenerator {
+public:
+  LayerGenerator(const CaveInfo &info,
+                 const std::vector<GenerationParams> &layers);
+
+  // pRoomGraphs (if given) is resized to a RoomGraph per layer. A rejected
+  // layer's TileMap is empty (see getStats).
+  std::vector<TileMap> generate(std::vector<RoomGraph> *pRoomGraphs = nullptr);
+
+  // mSteps and mStageMs include the shared steps
+  const GenerationStats &getStats(int layer) const { return mStats[layer]; }
+  // Time the last generate spent in the stage over all the layers, each
+  // shared step counted once
+  float getStageMs(Stage stage) const { return mStageMs[stage]; }
+  // CA steps that were shared rather than run again for the last generate
+  int getSharedSteps() const { return mSharedSteps; }
+
+  void setCancelToken(const CancelToken *token) { mCancel = token; }
+
+private:
+  // The layers in group (all with the same noise) have the same first
+  // depth steps, whose cells (null for none yet) and stats (mSteps and the
+  // noise and CA mStageMs) are given
+  void runGroup(const std::vector<int> &group, int depth,
+                const std::vector<uint8_t> *cells,
+                const GenerationStats &shared);
+  void finishLayer(int layer, int depth, const std::vector<uint8_t> *cells,
+                   const GenerationStats &shared);
+  // Adds the stage times of work done to mStageMs
+  void addStageMs(const GenerationStats &stats);
+
+  CaveInfo mInfo;
+  std::vector<GenerationParams> mLayers;
+  const CancelToken *mCancel = nullptr;
+  std::vector<TileMap> mTileMaps;
+  std::vector<GenerationStats> mStats;
+  std::vector<RoomGraph> *mRoomGraphs = nullptr;
+  std::atomic<int> mSharedSteps{0};
+  std::mutex mStageMutex;
+  float mStageMs[STAGE_COUNT] = {};
+};
+
+} // namespace Cave
+
+#endif
@@ -0,0 +1,503 @@
+//
+// The simplex noise (the gradients, SCALE, the corner contributions and the
+// fractal sum) follows SimplexNoise by Sebastien Rombauts,
+// https://github.com/SRombauts/SimplexNoise, under the MIT License:
+//
+// Copyright (c) 2014-2018 Sebastien Rombauts (sebastien.rombauts@gmail.com)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to permit
+// persons to whom the Software is furnished to do so, subject to the
+// following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN
+// NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+// DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+// OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+// USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "NoiseKernel.h"
+#include "SimplexNoise.h"
+
+#include "Debug.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CAVE_NOISE_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define CAVE_TARGET_AVX2
+#else
+#define CAVE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace Cave {
+
+namespace {
+//
+// Ken Perlin's permutation table
+//
+const uint8_t perm[256] = {
+    151, 160, 137, 91,  90,  15,  131, 13,  201, 95,  96,  53,  194, 233, 7,
+    225, 140, 36,  103, 30,  69,  142, 8,   99,  37,  240, 21,  10,  23,  190,
+    6,   148, 247, 120, 234, 75,  0,   26,  197, 62,  94,  252, 219, 203, 117,
+    35,  11,  32,  57,  177, 33,  88,  237, 149, 56,  87,  174, 20,  125, 136,
+    171, 168, 68,  175, 74,  165, 71,  134, 139, 48,  27,  166, 77,  146, 158,
+    231, 83,  111, 229, 122, 60,  211, 133, 230, 220, 105, 92,  41,  55,  46,
+    245, 40,  244, 102, 143, 54,  65,  25,  63,  161, 1,   216, 80,  73,  209,
+    76,  132, 187, 208, 89,  18,  169, 200, 196, 135, 130, 116, 188, 159, 86,
+    164, 100, 109, 198, 173, 186, 3,   64,  52,  217, 226, 250, 124, 123, 5,
+    202, 38,  147, 118, 126, 255, 82,  85,  212, 207, 206, 59,  227, 47,  16,
+    58,  17,  182, 189, 28,  42,  223, 183, 170, 213, 119, 248, 152, 2,   44,
+    154, 163, 70,  221, 153, 101, 155, 167, 43,  172, 9,   129, 22,  39,  253,
+    19,  98,  108, 110, 79,  113, 224, 232, 178, 185, 112, 104, 218, 246, 97,
+    228, 251, 34,  242, 193, 238, 210, 144, 12,  191, 179, 162, 241, 81,  51,
+    145, 235, 249, 14,  239, 107, 49,  192, 214, 31,  181, 199, 106, 157, 184,
+    84,  204, 176, 115, 121, 50,  45,  127, 4,   150, 254, 138, 236, 205, 93,
+    222, 114, 67,  29,  24,  72,  243, 141, 128, 195, 78,  66,  215, 61,  156,
+    180};
+
+const float F2 = 0.366025403f; // (sqrt(3) - 1) / 2
+const float G2 = 0.211324865f; // (3 - sqrt(3)) / 6
+const float G2x2_1 = -1.0f + 2.0f * 0.211324865f;
+const float SCALE = 45.23065f;
+
+inline int32_t fastfloor(float fp) {
+  int32_t i = static_cast<int32_t>(fp);
+  return (fp < i) ? (i - 1) : i;
+}
+
+inline int32_t hash(int32_t i) { return perm[static_cast<uint8_t>(i)]; }
+
+inline float grad(int32_t hash, float x, float y) {
+  const int32_t h = hash & 0x3F;
+  const float u = h < 4 ? x : y;
+  const float v = h < 4 ? y : x;
+  return ((h & 1) ? -u : u) + ((h & 2) ? -(2.0f * v) : 2.0f * v);
+}
+
+inline float corner(int32_t gi, float x, float y) {
+  float t = (0.5f - x * x) - y * y;
+  if (t < 0.0f)
+    return 0.0f;
+  t *= t;
+  return (t * t) * grad(gi, x, y);
+}
+
+//
+// One octave. The SIMD versions below must mirror this exactly.
+//
+float noise1(float x, float y) {
+  const float s = (x + y) * F2;
+  const int32_t i = fastfloor(x + s);
+  const int32_t j = fastfloor(y + s);
+  const float t = static_cast<float>(i + j) * G2;
+  const float x0 = x - (static_cast<float>(i) - t);
+  const float y0 = y - (static_cast<float>(j) - t);
+  const int32_t i1 = (x0 > y0) ? 1 : 0;
+  const int32_t j1 = (x0 > y0) ? 0 : 1;
+  const float x1 = (x0 - static_cast<float>(i1)) + G2;
+  const float y1 = (y0 - static_cast<float>(j1)) + G2;
+  const float x2 = x0 + G2x2_1;
+  const float y2 = y0 + G2x2_1;
+  const int32_t gi0 = hash(i + hash(j));
+  const int32_t gi1 = hash(i + i1 + hash(j + j1));
+  const int32_t gi2 = hash(i + 1 + hash(j + 1));
+  const float n0 = corner(gi0, x0, y0);
+  const float n1 = corner(gi1, x1, y1);
+  const float n2 = corner(gi2, x2, y2);
+  return SCALE * ((n0 + n1) + n2);
+}
+
+float fractal(float x, float y, int octaves) {
+  float output = 0.0f;
+  float denom = 0.0f;
+  float frequency = 1.0f;
+  float amplitude = 1.0f;
+  for (int o = 0; o < octaves; ++o) {
+    output += amplitude * noise1(x * frequency, y * frequency);
+    denom += amplitude;
+    frequency *= 2.0f;
+    amplitude *= 0.5f;
+  }
+  return output / denom;
+}
+
+void fillRowScalar(const float *xs, float y, int count, int octaves,
+                   float *out) {
+  for (int i = 0; i < count; ++i) {
+    out[i] = fractal(xs[i], y, octaves);
+  }
+}
+
+#ifdef CAVE_NOISE_X86
+//
+// SSE2: 4 cells at a time. No gather so the hashes are done per lane.
+//
+inline __m128 blend4(__m128 mask, __m128 a, __m128 b) {
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+inline __m128i floor4(__m128 v) {
+  __m128i i = _mm_cvttps_epi32(v);
+  __m128 lt = _mm_cmplt_ps(v, _mm_cvtepi32_ps(i));
+  return _mm_add_epi32(i, _mm_castps_si128(lt));
+}
+
+inline __m128 grad4(__m128i gi, __m128 x, __m128 y) {
+  const __m128i h = _mm_and_si128(gi, _mm_set1_epi32(0x3F));
+  const __m128 small = _mm_castsi128_ps(_mm_cmplt_epi32(h, _mm_set1_epi32(4)));
+  const __m128 u = blend4(small, x, y);
+  const __m128 v = _mm_mul_ps(_mm_set1_ps(2.0f), blend4(small, y, x));
+  const __m128 signU = _mm_castsi128_ps(
+      _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31));
+  const __m128 signV = _mm_castsi128_ps(
+      _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30));
+  return _mm_add_ps(_mm_xor_ps(u, signU), _mm_xor_ps(v, signV));
+}
+
+inline __m128 corner4(__m128i gi, __m128 x, __m128 y) {
+  __m128 t = _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(0.5f), _mm_mul_ps(x, x)),
+                        _mm_mul_ps(y, y));
+  const __m128 neg = _mm_cmplt_ps(t, _mm_setzero_ps());
+  t = _mm_mul_ps(t, t);
+  const __m128 n = _mm_mul_ps(_mm_mul_ps(t, t), grad4(gi, x, y));
+  return _mm_andnot_ps(neg, n);
+}
+
+__m128 noise4(__m128 x, __m128 y) {
+  const __m128 s = _mm_mul_ps(_mm_add_ps(x, y), _mm_set1_ps(F2));
+  const __m128i i = floor4(_mm_add_ps(x, s));
+  const __m128i j = floor4(_mm_add_ps(y, s));
+  const __m128 t =
+      _mm_mul_ps(_mm_cvtepi32_ps(_mm_add_epi32(i, j)), _mm_set1_ps(G2));
+  const __m128 x0 = _mm_sub_ps(x, _mm_sub_ps(_mm_cvtepi32_ps(i), t));
+  const __m128 y0 = _mm_sub_ps(y, _mm_sub_ps(_mm_cvtepi32_ps(j), t));
+  const __m128 xGreater = _mm_cmpgt_ps(x0, y0);
+  const __m128i i1 =
+      _mm_and_si128(_mm_castps_si128(xGreater), _mm_set1_epi32(1));
+  const __m128i j1 = _mm_sub_epi32(_mm_set1_epi32(1), i1);
+  const __m128 x1 =
+      _mm_add_ps(_mm_sub_ps(x0, _mm_cvtepi32_ps(i1)), _mm_set1_ps(G2));
+  const __m128 y1 =
+      _mm_add_ps(_mm_sub_ps(y0, _mm_cvtepi32_ps(j1)), _mm_set1_ps(G2));
+  const __m128 x2 = _mm_add_ps(x0, _mm_set1_ps(G2x2_1));
+  const __m128 y2 = _mm_add_ps(y0, _mm_set1_ps(G2x2_1));
+
+  alignas(16) int32_t ia[4], ja[4], i1a[4], j1a[4];
+  alignas(16) int32_t g0[4], g1[4], g2[4];
+  _mm_store_si128((__m128i *)ia, i);
+  _mm_store_si128((__m128i *)ja, j);
+  _mm_store_si128((__m128i *)i1a, i1);
+  _mm_store_si128((__m128i *)j1a, j1);
+  for (int l = 0; l < 4; ++l) {
+    g0[l] = hash(ia[l] + hash(ja[l]));
+    g1[l] = hash(ia[l] + i1a[l] + hash(ja[l] + j1a[l]));
+    g2[l] = hash(ia[l] + 1 + hash(ja[l] + 1));
+  }
+  const __m128 n0 = corner4(_mm_load_si128((const __m128i *)g0), x0, y0);
+  const __m128 n1 = corner4(_mm_load_si128((const __m128i *)g1), x1, y1);
+  const __m128 n2 = corner4(_mm_load_si128((const __m128i *)g2), x2, y2);
+  return _mm_mul_ps(_mm_set1_ps(SCALE), _mm_add_ps(_mm_add_ps(n0, n1), n2));
+}
+
+void fillRowSSE2(const float *xs, float y, int count, int octaves,
+                 float *out) {
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128 x = _mm_loadu_ps(xs + i);
+    __m128 output = _mm_setzero_ps();
+    float denom = 0.0f;
+    float frequency = 1.0f;
+    float amplitude = 1.0f;
+    for (int o = 0; o < octaves; ++o) {
+      const __m128 f = _mm_set1_ps(frequency);
+      const __m128 n = noise4(_mm_mul_ps(x, f), _mm_set1_ps(y * frequency));
+      output = _mm_add_ps(output, _mm_mul_ps(_mm_set1_ps(amplitude), n));
+      denom += amplitude;
+      frequency *= 2.0f;
+      amplitude *= 0.5f;
+    }
+    _mm_storeu_ps(out + i, _mm_div_ps(output, _mm_set1_ps(denom)));
+  }
+  fillRowScalar(xs + i, y, count - i, octaves, out + i);
+}
+
+//
+// AVX2: 8 cells at a time with gathers for the permutation lookups.
+//
+int32_t permInt[256];
+
+CAVE_TARGET_AVX2 inline __m256i floor8(__m256 v) {
+  __m256i i = _mm256_cvttps_epi32(v);
+  __m256 lt = _mm256_cmp_ps(v, _mm256_cvtepi32_ps(i), _CMP_LT_OQ);
+  return _mm256_add_epi32(i, _mm256_castps_si256(lt));
+}
+
+CAVE_TARGET_AVX2 inline __m256i hash8(__m256i i) {
+  return _mm256_i32gather_epi32(
+      permInt, _mm256_and_si256(i, _mm256_set1_epi32(0xFF)), 4);
+}
+
+CAVE_TARGET_AVX2 inline __m256 grad8(__m256i gi, __m256 x, __m256 y) {
+  const __m256i h = _mm256_and_si256(gi, _mm256_set1_epi32(0x3F));
+  const __m256 small =
+      _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(4), h));
+  const __m256 u = _mm256_blendv_ps(y, x, small);
+  const __m256 v = _mm256_mul_ps(_mm256_set1_ps(2.0f),
+                                 _mm256_blendv_ps(x, y, small));
+  const __m256 signU = _mm256_castsi256_ps(
+      _mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(1)), 31));
+  const __m256 signV = _mm256_castsi256_ps(
+      _mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(2)), 30));
+  return _mm256_add_ps(_mm256_xor_ps(u, signU), _mm256_xor_ps(v, signV));
+}
+
+CAVE_TARGET_AVX2 inline __m256 corner8(__m256i gi, __m256 x, __m256 y) {
+  __m256 t = _mm256_sub_ps(
+      _mm256_sub_ps(_mm256_set1_ps(0.5f), _mm256_mul_ps(x, x)),
+      _mm256_mul_ps(y, y));
+  const __m256 neg = _mm256_cmp_ps(t, _mm256_setzero_ps(), _CMP_LT_OQ);
+  t = _mm256_mul_ps(t, t);
+  const __m256 n = _mm256_mul_ps(_mm256_mul_ps(t, t), grad8(gi, x, y));
+  return _mm256_andnot_ps(neg, n);
+}
+
+CAVE_TARGET_AVX2 __m256 noise8(__m256 x, __m256 y) {
+  const __m256 s = _mm256_mul_ps(_mm256_add_ps(x, y), _mm256_set1_ps(F2));
+  const __m256i i = floor8(_mm256_add_ps(x, s));
+  const __m256i j = floor8(_mm256_add_ps(y, s));
+  const __m256 t = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(i, j)),
+                                 _mm256_set1_ps(G2));
+  const __m256 x0 = _mm256_sub_ps(x, _mm256_sub_ps(_mm256_cvtepi32_ps(i), t));
+  const __m256 y0 = _mm256_sub_ps(y, _mm256_sub_ps(_mm256_cvtepi32_ps(j), t));
+  const __m256 xGreater = _mm256_cmp_ps(x0, y0, _CMP_GT_OQ);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i i1 = _mm256_and_si256(_mm256_castps_si256(xGreater), one);
+  const __m256i j1 = _mm256_sub_epi32(one, i1);
+  const __m256 x1 = _mm256_add_ps(_mm256_sub_ps(x0, _mm256_cvtepi32_ps(i1)),
+                                  _mm256_set1_ps(G2));
+  const __m256 y1 = _mm256_add_ps(_mm256_sub_ps(y0, _mm256_cvtepi32_ps(j1)),
+                                  _mm256_set1_ps(G2));
+  const __m256 x2 = _mm256_add_ps(x0, _mm256_set1_ps(G2x2_1));
+  const __m256 y2 = _mm256_add_ps(y0, _mm256_set1_ps(G2x2_1));
+
+  const __m256i gi0 = hash8(_mm256_add_epi32(i, hash8(j)));
+  const __m256i gi1 = hash8(_mm256_add_epi32(
+      _mm256_add_epi32(i, i1), hash8(_mm256_add_epi32(j, j1))));
+  const __m256i gi2 = hash8(_mm256_add_epi32(
+      _mm256_add_epi32(i, one), hash8(_mm256_add_epi32(j, one))));
+  const __m256 n0 = corner8(gi0, x0, y0);
+  const __m256 n1 = corner8(gi1, x1, y1);
+  const __m256 n2 = corner8(gi2, x2, y2);
+  return _mm256_mul_ps(_mm256_set1_ps(SCALE),
+                       _mm256_add_ps(_mm256_add_ps(n0, n1), n2));
+}
+
+CAVE_TARGET_AVX2 void fillRowAVX2(const float *xs, float y, int count,
+                                  int octaves, float *out) {
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256 x = _mm256_loadu_ps(xs + i);
+    __m256 output = _mm256_setzero_ps();
+    float denom = 0.0f;
+    float frequency = 1.0f;
+    float amplitude = 1.0f;
+    for (int o = 0; o < octaves; ++o) {
+      const __m256 f = _mm256_set1_ps(frequency);
+      const __m256 n =
+          noise8(_mm256_mul_ps(x, f), _mm256_set1_ps(y * frequency));
+      output =
+          _mm256_add_ps(output, _mm256_mul_ps(_mm256_set1_ps(amplitude), n));
+      denom += amplitude;
+      frequency *= 2.0f;
+      amplitude *= 0.5f;
+    }
+    _mm256_storeu_ps(out + i, _mm256_div_ps(output, _mm256_set1_ps(denom)));
+  }
+  fillRowSSE2(xs + i, y, count - i, octaves, out + i);
+}
+
+bool cpuHasAVX2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return false;
+  __cpuid(info, 1);
+  const bool osxsave = (info[2] & (1 << 27)) != 0;
+  if (!osxsave || (_xgetbv(0) & 0x6) != 0x6)
+    return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif // CAVE_NOISE_X86
+
+using FillRowFn = void (*)(const float *, float, int, int, float *);
+
+struct Dispatch {
+  NoiseKernel::Isa isa = NoiseKernel::SCALAR;
+  FillRowFn fill = &fillRowScalar;
+
+  Dispatch() {
+#ifdef CAVE_NOISE_X86
+    for (int i = 0; i < 256; ++i) {
+      permInt[i] = perm[i];
+    }
+    isa = NoiseKernel::SSE2;
+    fill = &fillRowSSE2;
+    if (cpuHasAVX2()) {
+      isa = NoiseKernel::AVX2;
+      fill = &fillRowAVX2;
+    }
+#endif
+  }
+};
+
+const Dispatch &getDispatch() {
+  static const Dispatch dispatch;
+  return dispatch;
+}
+
+} // namespace
+
+void NoiseKernel::fillRow(const float *xs, float y, int count, int octaves,
+                          float *out) {
+  getDispatch().fill(xs, y, count, (octaves < 1) ? 1 : octaves, out);
+}
+
+float NoiseKernel::noise(float x, float y, int octaves) {
+  return fractal(x, y, (octaves < 1) ? 1 : octaves);
+}
+
+int NoiseKernel::fillWalls(const double *xs, double y, int count,
+                           int octaves, uint8_t *walls) {
+  double extent = std::fabs(y);
+  for (int i = 0; i < count; ++i) {
+    extent = std::max(extent, std::fabs(xs[i]));
+  }
+  if (!matchesLibrary(octaves, extent)) {
+    fillWallsLibrary(xs, y, count, octaves, walls);
+    return count;
+  }
+  // Reused for every row on the thread
+  thread_local std::vector<float> xf;
+  thread_local std::vector<float> out;
+  xf.resize(count);
+  out.resize(count);
+  for (int i = 0; i < count; ++i) {
+    xf[i] = (float)xs[i];
+  }
+  fillRow(xf.data(), (float)y, count, octaves, out.data());
+  int resolved = 0;
+  for (int i = 0; i < count; ++i) {
+    if (std::fabs(out[i]) < BAND) {
+      walls[i] = (Algo::getSNoise2(xs[i], y, octaves) < 0) ? 1 : 0;
+      ++resolved;
+    } else {
+      walls[i] = (out[i] < 0) ? 1 : 0;
+    }
+  }
+  return resolved;
+}
+
+void NoiseKernel::fillWallsLibrary(const double *xs, double y, int count,
+                                   int octaves, uint8_t *walls) {
+  for (int i = 0; i < count; ++i) {
+    walls[i] = (Algo::getSNoise2(xs[i], y, octaves) < 0) ? 1 : 0;
+  }
+}
+
+double NoiseKernel::getProbeLimit(double extent) {
+  double limit = 1;
+  while (limit < extent && limit < 1e30) {
+    limit *= 2;
+  }
+  return limit;
+}
+
+double NoiseKernel::maxLibraryError(int octaves, double extent) {
+  // Rows of non-integer points spread from -1 to the limit, the last row
+  // and the last points of each row right by it (where the float error is
+  // largest), through the dispatched kernel
+  const int PROBES = 64;
+  const int ROWS = 16;
+  const double limit = getProbeLimit(extent);
+  double xs[PROBES];
+  float xf[PROBES];
+  float out[PROBES];
+  double maxError = 0;
+  for (int row = 0; row < ROWS; ++row) {
+    const double y = -1 + (limit + 1) * (row + 0.613) / ROWS;
+    for (int i = 0; i < PROBES; ++i) {
+      xs[i] = -1 + (limit + 1) * (i + 0.371 + 0.037 * (row % 8)) / PROBES;
+      xf[i] = (float)xs[i];
+    }
+    fillRow(xf, (float)y, PROBES, octaves, out);
+    for (int i = 0; i < PROBES; ++i) {
+      double error = std::fabs(Algo::getSNoise2(xs[i], y, octaves) - out[i]);
+      maxError = std::max(maxError, error);
+    }
+  }
+  return maxError;
+}
+
+bool NoiseKernel::matchesLibrary(int octaves, double extent) {
+  const double limit = getProbeLimit(extent);
+  const std::pair<int, double> key(octaves, limit);
+  static std::mutex mutex;
+  static std::map<std::pair<int, double>, bool> cache;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = cache.find(key);
+    if (it != cache.end())
+      return it->second;
+  }
+
+  // Two threads may both probe the first time, they get the same answer
+  const double maxError = maxLibraryError(octaves, extent);
+  const bool matches = maxError < MAX_ERROR;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    cache[key] = matches;
+  }
+  LOG_INFO("NOISE KERNEL: " << getIsaName() << " octaves: " << octaves
+                            << " up to: " << limit << " max error: "
+                            << maxError << " matches: " << matches);
+  return matches;
+}
+
+NoiseKernel::Isa NoiseKernel::getIsa() { return getDispatch().isa; }
+
+const char *NoiseKernel::getIsaName() {
+  switch (getIsa()) {
+  case AVX2:
+    return "AVX2";
+  case SSE2:
+    return "SSE2";
+  default:
+    return "SCALAR";
+  }
+}
+
+} // namespace Cave
@@ -0,0 +1,65 @@
+#ifndef NOISE_KERNEL_H
+#define NOISE_KERNEL_H
+
+#include <cstdint>
+
+namespace Cave {
+
+//
+// Fractal 2D simplex noise for a whole row of cells per call.
+//
+// The octaves use lacunarity 2 and persistence 0.5 and the sum is divided
+// by the total amplitude. Everything is done in float with the same
+// operations in the same order in the scalar, SSE2 and AVX2 versions, so
+// the result (and so the wall/floor threshold on it) is bit identical
+// whichever is picked at runtime.
+//
+// It is meant as a drop in for Algo::getSNoise2, but that is done in double
+// (and its source isn't here), so a float value near 0 can land on the
+// other side of the threshold. fillWalls only trusts the sign of a kernel
+// value at least BAND from 0 and asks Algo::getSNoise2 for the rest, so
+// the walls are the library's wherever the kernel is out by less than
+// BAND. The float error grows with the coordinates, so before using the
+// kernel for a row fillWalls checks (matchesLibrary) that it is out by
+// under MAX_ERROR (a quarter of BAND) on probe points over the row's range
+// of coordinates, and leaves it all to the library if not.
+//
+class NoiseKernel {
+public:
+  static constexpr double BAND = 2e-3;
+  static constexpr double MAX_ERROR = BAND / 4;
+
+  enum Isa { SCALAR, SSE2, AVX2 };
+
+  // out[i] = noise(xs[i], y) for i < count
+  static void fillRow(const float *xs, float y, int count, int octaves,
+                      float *out);
+  // Single point, same as a fillRow of 1
+  static float noise(float x, float y, int octaves);
+
+  // walls[i] = 1 if the noise at (xs[i], y) is < 0, else 0. Values within
+  // BAND of 0 (or all of them, if the kernel doesn't match the library over
+  // these coordinates) are worked out with Algo::getSNoise2 at the double
+  // coordinates; returns how many were.
+  static int fillWalls(const double *xs, double y, int count, int octaves,
+                       uint8_t *walls);
+  // The same from Algo::getSNoise2 alone, a call per cell
+  static void fillWallsLibrary(const double *xs, double y, int count,
+                               int octaves, uint8_t *walls);
+
+  // Largest difference from Algo::getSNoise2 for the octave count over
+  // probe points with x and y from -1 up to getProbeLimit(extent)
+  static double maxLibraryError(int octaves, double extent);
+  // maxLibraryError < MAX_ERROR for coordinates no further than extent
+  // from 0. Cached per octave count and probe limit.
+  static bool matchesLibrary(int octaves, double extent);
+  // extent rounded up to a power of 2 (at least 1)
+  static double getProbeLimit(double extent);
+
+  static Isa getIsa();
+  static const char *getIsaName();
+};
+
+} // namespace Cave
+
+#endif
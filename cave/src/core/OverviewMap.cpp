@@ -0,0 +1,75 @@
+#include "OverviewMap.h"
+#include "Cave.h"
+
+#include "Debug.h"
+
+namespace Cave {
+
+namespace {
+// Wall and total cell counts for one overview cell. Edge cells can cover
+// fewer than scale x scale cells when the size isn't a power of 2.
+struct Count {
+  uint32_t walls = 0;
+  uint32_t cells = 0;
+};
+} // namespace
+
+//
+// Only the first level reads the full resolution map. Every other level is
+// made from the counts of the level before so the cost is one pass over the
+// cave plus a third of that again for the whole chain.
+//
+OverviewMap::OverviewMap(const TileMap &tileMap, const CaveInfo &info,
+                         int levels, int threshold) {
+  int w = info.mCaveWidth;
+  int h = info.mCaveHeight;
+  std::vector<Count> counts(w * h);
+  for (int cy = 0; cy < h; ++cy) {
+    for (int cx = 0; cx < w; ++cx) {
+      Count &c = counts[cy * w + cx];
+      c.walls = Cave::isFloor(tileMap, cx, cy) ? 0 : 1;
+      c.cells = 1;
+    }
+  }
+
+  int scale = 1;
+  for (int lvl = 0; lvl < levels && (w > 1 || h > 1); ++lvl) {
+    const int nw = (w + 1) / 2;
+    const int nh = (h + 1) / 2;
+    std::vector<Count> next(nw * nh);
+    for (int y = 0; y < h; ++y) {
+      for (int x = 0; x < w; ++x) {
+        const Count &c = counts[y * w + x];
+        Count &n = next[(y / 2) * nw + (x / 2)];
+        n.walls += c.walls;
+        n.cells += c.cells;
+      }
+    }
+    scale *= 2;
+
+    OverviewLevel level;
+    level.mScale = scale;
+    level.mWidth = nw;
+    level.mHeight = nh;
+    level.mCoverage.resize(nw * nh);
+    for (int i = 0; i < nw * nh; ++i) {
+      // In 64 bits, a deep level's cell can cover over 2^24 cave cells
+      const uint64_t walls = next[i].walls;
+      int value = (int)((walls * 255 + next[i].cells / 2) / next[i].cells);
+      if (threshold >= 0) {
+        value = (value >= threshold) ? 255 : 0;
+      }
+      level.mCoverage[i] = value;
+    }
+    mLevels.push_back(std::move(level));
+
+    counts.swap(next);
+    w = nw;
+    h = nh;
+  }
+  LOG_INFO("OVERVIEW: levels: " << mLevels.size());
+}
+
+OverviewMap::~OverviewMap() {}
+
+} // namespace Cave
@@ -0,0 +1,40 @@
+#ifndef OVERVIEW_MAP_H
+#define OVERVIEW_MAP_H
+
+#include "CaveInfo.h"
+#include "TileTypes.h"
+#include <cstdint>
+#include <vector>
+
+namespace Cave {
+
+//
+// Downsampled wall coverage of the cave cells (no border). Level 0 is 2x
+// down, level 1 is 4x etc. Each value is 0 (all floor) to 255 (all wall),
+// or exactly 0/255 if a threshold is used.
+//
+struct OverviewLevel {
+  int mScale = 1;
+  int mWidth = 0;
+  int mHeight = 0;
+  std::vector<uint8_t> mCoverage;
+};
+
+class OverviewMap {
+public:
+  // Stops early if a level would be less than 1 cell. threshold < 0 gives
+  // the fractional coverage, otherwise values >= threshold become 255.
+  OverviewMap(const TileMap &tileMap, const CaveInfo &info, int levels,
+              int threshold = -1);
+  ~OverviewMap();
+
+  int getLevelCount() const { return mLevels.size(); }
+  const OverviewLevel &getLevel(int level) const { return mLevels[level]; }
+
+private:
+  std::vector<OverviewLevel> mLevels;
+};
+
+} // namespace Cave
+
+#endif
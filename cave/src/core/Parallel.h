@@ -0,0 +1,41 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+namespace Cave {
+
+// threads <= 0 means one per core
+inline int resolveThreads(int threads) {
+  if (threads > 0)
+    return threads;
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Split rows into at most threads bands of at least minRows each
+inline int bandCount(int rows, int threads, int minRows) {
+  return std::max(1, std::min(resolveThreads(threads), rows / minRows));
+}
+
+// Run fn(0..count-1) on a thread each (inline if just the one)
+template <typename Fn> void parallelFor(int count, Fn fn) {
+  if (count <= 0)
+    return;
+  if (count == 1) {
+    fn(0);
+    return;
+  }
+  std::vector<std::thread> workers;
+  for (int i = 0; i < count; ++i) {
+    workers.emplace_back(fn, i);
+  }
+  for (auto &t : workers) {
+    t.join();
+  }
+}
+
+} // namespace Cave
+
+#endif
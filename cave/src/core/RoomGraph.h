@@ -0,0 +1,58 @@
+#ifndef ROOM_GRAPH_H
+#define ROOM_GRAPH_H
+
+#include "CaveInfo.h"
+#include <vector>
+
+namespace Cave {
+
+//
+// The rooms found by findRooms and the tunnels joinRooms dug between them.
+// All positions are cave cell coords (0,0 is the first non-border cell).
+//
+// Room ids are compact (0..N-1) and assigned in raster order of each room's
+// first cell, so they are stable for a given map.
+//
+struct RoomInfo {
+  int mId = 0;
+  int mCellCount = 0;
+  // Inclusive bounding box
+  Vector2i mMin;
+  Vector2i mMax;
+  float mCentroidX = 0;
+  float mCentroidY = 0;
+};
+
+//
+// An MST edge. The tunnel is mThickness cells starting at mStart and
+// stepping by mDir.
+//
+struct RoomEdge {
+  int mRoom1 = 0;
+  int mRoom2 = 0;
+  Vector2i mStart;
+  Vector2i mDir;
+  int mThickness = 0;
+};
+
+struct RoomGraph {
+  int mWidth = 0;
+  int mHeight = 0;
+  std::vector<RoomInfo> mRooms;
+  std::vector<RoomEdge> mEdges;
+  // mWidth x mHeight room id per cell (row major). -1 for anything that
+  // wasn't floor when the rooms were found (walls and dug tunnels).
+  std::vector<int> mLabels;
+
+  void clear() {
+    mWidth = 0;
+    mHeight = 0;
+    mRooms.clear();
+    mEdges.clear();
+    mLabels.clear();
+  }
+};
+
+} // namespace Cave
+
+#endif
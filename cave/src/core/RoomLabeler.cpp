@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "Parallel.h"
+#include "RoomLabeler.h"
+#include "Trace.h"
+
+#include "Debug.h"
+
+namespace Cave {
+
+namespace {
+// Below this many rows per band the threads cost more than they save
+const int MIN_BAND_ROWS = 64;
+
+//
+// Lock free union-find over the cell indices. Only the seam merging
+// actually races, the bands only touch their own cells.
+//
+class AtomicUnionFind {
+public:
+  explicit AtomicUnionFind(int size) : mParent(new std::atomic<int>[size]) {}
+
+  void make(int i) { mParent[i].store(i, std::memory_order_relaxed); }
+
+  int find(int i) {
+    int p = mParent[i].load(std::memory_order_relaxed);
+    while (p != i) {
+      // Path halving, losing the race just means less compression
+      int gp = mParent[p].load(std::memory_order_relaxed);
+      if (gp != p) {
+        mParent[i].compare_exchange_weak(p, gp, std::memory_order_relaxed);
+      }
+      i = p;
+      p = mParent[i].load(std::memory_order_relaxed);
+    }
+    return i;
+  }
+
+  void unite(int a, int b) {
+    while (true) {
+      a = find(a);
+      b = find(b);
+      if (a == b)
+        return;
+      if (a < b)
+        std::swap(a, b);
+      // Link the larger root under the smaller. Fails if a stopped being a
+      // root meanwhile, so go round again.
+      int expected = a;
+      if (mParent[a].compare_exchange_strong(expected, b,
+                                             std::memory_order_acq_rel))
+        return;
+    }
+  }
+
+private:
+  std::unique_ptr<std::atomic<int>[]> mParent;
+};
+
+} // namespace
+
+int RoomLabeler::label(const std::vector<uint8_t> &floor, int width,
+                       int height, int threads, std::vector<int> &labels,
+                       const CancelToken *cancel) {
+  const int size = width * height;
+  labels.assign(size, -1);
+  if (size == 0)
+    return 0;
+
+  const int bands = bandCount(height, threads, MIN_BAND_ROWS);
+  const int rowsPerBand = (height + bands - 1) / bands;
+  auto bandStart = [&](int b) { return std::min(height, b * rowsPerBand); };
+
+  AtomicUnionFind uf(size);
+
+  // 1. Label each band on its own
+  parallelFor(bands, [&](int b) {
+    TraceScope trace("label_band", -1, b);
+    for (int y = bandStart(b); y < bandStart(b + 1); ++y) {
+      if (isCancelled(cancel))
+        return;
+      for (int x = 0; x < width; ++x) {
+        const int i = y * width + x;
+        if (!floor[i])
+          continue;
+        uf.make(i);
+        if (x > 0 && floor[i - 1])
+          uf.unite(i, i - 1);
+        if (y > bandStart(b) && floor[i - width])
+          uf.unite(i, i - width);
+      }
+    }
+  });
+
+  if (isCancelled(cancel))
+    return 0;
+
+  // 2. Stitch the seams (the first row of each band to the row above)
+  parallelFor(bands - 1, [&](int s) {
+    TraceScope trace("label_seam", -1, s);
+    const int y = bandStart(s + 1);
+    if (y >= height)
+      return;
+    for (int x = 0; x < width; ++x) {
+      const int i = y * width + x;
+      if (floor[i] && floor[i - width])
+        uf.unite(i, i - width);
+    }
+  });
+
+  // 3. Number the roots in raster order. Each band counts its roots then
+  // numbers them from the total of the bands before it.
+  std::vector<int> rootCount(bands, 0);
+  parallelFor(bands, [&](int b) {
+    for (int i = bandStart(b) * width; i < bandStart(b + 1) * width; ++i) {
+      if (floor[i] && uf.find(i) == i) {
+        labels[i] = rootCount[b]++;
+      }
+    }
+  });
+  std::vector<int> firstId(bands, 0);
+  for (int b = 1; b < bands; ++b) {
+    firstId[b] = firstId[b - 1] + rootCount[b - 1];
+  }
+  const int rooms = firstId[bands - 1] + rootCount[bands - 1];
+  parallelFor(bands, [&](int b) {
+    for (int i = bandStart(b) * width; i < bandStart(b + 1) * width; ++i) {
+      if (floor[i] && uf.find(i) == i) {
+        labels[i] += firstId[b];
+      }
+    }
+  });
+
+  // 4. Every other floor cell takes its root's id
+  parallelFor(bands, [&](int b) {
+    for (int i = bandStart(b) * width; i < bandStart(b + 1) * width; ++i) {
+      if (floor[i]) {
+        int root = uf.find(i);
+        if (root != i)
+          labels[i] = labels[root];
+      }
+    }
+  });
+  LOG_INFO("ROOM LABELER: bands: " << bands << " rooms: " << rooms);
+  return rooms;
+}
+
+} // namespace Cave
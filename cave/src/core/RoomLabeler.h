@@ -0,0 +1,32 @@
+#ifndef ROOM_LABELER_H
+#define ROOM_LABELER_H
+
+#include "CancelToken.h"
+#include <cstdint>
+#include <vector>
+
+namespace Cave {
+
+//
+// 4-connected labelling of the floor cells, split into horizontal bands
+// labelled on separate threads then stitched along the band seams.
+//
+// The union-find always links the larger root under the smaller one so a
+// room's root is its first cell in raster order whatever the thread count.
+// Room ids are then numbered in that order, so they are the same for any
+// number of threads.
+//
+class RoomLabeler {
+public:
+  // floor is width x height (non-zero = floor). labels gets the room id per
+  // cell or -1 for a wall. threads <= 0 uses the hardware concurrency.
+  // Returns the number of rooms. If cancel is set part way labels is left
+  // all -1 and 0 returned.
+  static int label(const std::vector<uint8_t> &floor, int width, int height,
+                   int threads, std::vector<int> &labels,
+                   const CancelToken *cancel = nullptr);
+};
+
+} // namespace Cave
+
+#endif
@@ -0,0 +1,52 @@
+#include "RowSink.h"
+#include <cstdint>
+
+#include "Debug.h"
+
+namespace Cave {
+
+void TileMapSink::begin(int width, int height) {
+  mTileMap.assign(height, std::vector<int>(width, WALL));
+}
+
+void TileMapSink::writeRow(int y, const std::vector<int> &row) {
+  mTileMap[y] = row;
+}
+
+FileRowSink::FileRowSink(const std::string &path) : mPath(path) {}
+
+FileRowSink::~FileRowSink() { end(); }
+
+void FileRowSink::begin(int width, int height) {
+  mFile = std::fopen(mPath.c_str(), "wb");
+  if (!mFile) {
+    LOG_INFO("ROW SINK: can't open " << mPath);
+    mOk = false;
+    return;
+  }
+  unsigned char header[8];
+  for (int i = 0; i < 4; ++i) {
+    header[i] = (unsigned char)((uint32_t)width >> (8 * i));
+    header[4 + i] = (unsigned char)((uint32_t)height >> (8 * i));
+  }
+  mOk = std::fwrite(header, 1, sizeof(header), mFile) == sizeof(header);
+}
+
+void FileRowSink::writeRow(int /*y*/, const std::vector<int> &row) {
+  if (!mFile || !mOk)
+    return;
+  mBytes.resize(row.size());
+  for (size_t x = 0; x < row.size(); ++x) {
+    mBytes[x] = (unsigned char)row[x];
+  }
+  mOk = std::fwrite(mBytes.data(), 1, mBytes.size(), mFile) == mBytes.size();
+}
+
+void FileRowSink::end() {
+  if (mFile) {
+    mOk = (std::fclose(mFile) == 0) && mOk;
+    mFile = nullptr;
+  }
+}
+
+} // namespace Cave
@@ -0,0 +1,62 @@
+#ifndef ROW_SINK_H
+#define ROW_SINK_H
+
+#include "TileTypes.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace Cave {
+
+//
+// Where the CaveStreamer sends the finished TileMap, one row at a time in
+// order (TileMap rows so border included, y = 0 .. mCaveHeight + 1).
+//
+class RowSink {
+public:
+  virtual ~RowSink() {}
+
+  virtual void begin(int /*width*/, int /*height*/) {}
+  virtual void writeRow(int y, const std::vector<int> &row) = 0;
+  virtual void end() {}
+};
+
+// Builds an ordinary TileMap (so only for maps that fit in memory)
+class TileMapSink : public RowSink {
+public:
+  void begin(int width, int height) override;
+  void writeRow(int y, const std::vector<int> &row) override;
+
+  TileMap &getTileMap() { return mTileMap; }
+
+private:
+  TileMap mTileMap;
+};
+
+//
+// Writes a file of
+//   int32 width, int32 height (little endian, of the TileMap)
+//   then a byte (the TileName) per tile, row by row
+//
+class FileRowSink : public RowSink {
+public:
+  explicit FileRowSink(const std::string &path);
+  ~FileRowSink();
+
+  // false if the file couldn't be opened or a write failed
+  bool isOk() const { return mOk; }
+
+  void begin(int width, int height) override;
+  void writeRow(int y, const std::vector<int> &row) override;
+  void end() override;
+
+private:
+  std::string mPath;
+  FILE *mFile = nullptr;
+  bool mOk = true;
+  std::vector<unsigned char> mBytes;
+};
+
+} // namespace Cave
+
+#endif
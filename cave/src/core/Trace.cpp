@@ -0,0 +1,197 @@
+#include "Trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#include "Debug.h"
+
+namespace Cave {
+
+std::atomic<bool> Trace::sEnabled{false};
+
+namespace {
+
+struct Event {
+  const char *name;
+  int thread;
+  int step;
+  int block;
+  uint64_t start;
+  uint64_t end;
+};
+
+const int BUFFER_EVENTS = 1 << 14;
+
+// Only its thread writes to it. mCount is stored after the event so dump
+// only reads whole events.
+struct Buffer {
+  int mLane = 0;
+  std::unique_ptr<Event[]> mEvents{new Event[BUFFER_EVENTS]};
+  std::atomic<int> mCount{0};
+  std::atomic<int> mDropped{0};
+};
+
+// The lock is only taken when a thread first records, when it ends and
+// for dump/clear
+struct Registry {
+  std::mutex mMutex;
+  std::vector<std::unique_ptr<Buffer>> mBuffers;
+  std::vector<Buffer *> mFree;
+
+  Buffer *acquire() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mFree.empty()) {
+      Buffer *buffer = mFree.back();
+      mFree.pop_back();
+      return buffer;
+    }
+    mBuffers.push_back(std::make_unique<Buffer>());
+    mBuffers.back()->mLane = mBuffers.size() - 1;
+    return mBuffers.back().get();
+  }
+
+  void release(Buffer *buffer) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFree.push_back(buffer);
+  }
+};
+
+// Never destroyed, threads can end after the statics are gone
+Registry &registry() {
+  static Registry *r = new Registry;
+  return *r;
+}
+
+struct ThreadSlot {
+  Buffer *mBuffer = nullptr;
+  ~ThreadSlot() {
+    if (mBuffer)
+      registry().release(mBuffer);
+  }
+};
+
+thread_local ThreadSlot tSlot;
+
+// Each OS thread that records gets the next number (from 1), so events from
+// different threads that reused a buffer can still be told apart
+std::atomic<int> sThreadCount{0};
+thread_local int tThread = 0;
+
+// CAVE_TRACE=<file>
+struct EnvTrace {
+  std::string mPath;
+  EnvTrace() {
+    const char *path = std::getenv("CAVE_TRACE");
+    if (path && *path) {
+      mPath = path;
+      Trace::setEnabled(true);
+    }
+  }
+  ~EnvTrace() {
+    if (!mPath.empty())
+      Trace::dump(mPath);
+  }
+};
+
+EnvTrace envTrace;
+
+} // namespace
+
+void Trace::setEnabled(bool enabled) {
+  sEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+uint64_t Trace::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void Trace::record(const char *name, int step, int block, uint64_t start,
+                   uint64_t end) {
+  if (!tSlot.mBuffer) {
+    tSlot.mBuffer = registry().acquire();
+    tThread = sThreadCount.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+  Buffer &buffer = *tSlot.mBuffer;
+  const int n = buffer.mCount.load(std::memory_order_relaxed);
+  if (n >= BUFFER_EVENTS) {
+    buffer.mDropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  buffer.mEvents[n] = {name, tThread, step, block, start, end};
+  buffer.mCount.store(n + 1, std::memory_order_release);
+}
+
+void Trace::clear() {
+  Registry &r = registry();
+  std::lock_guard<std::mutex> lock(r.mMutex);
+  for (auto &buffer : r.mBuffers) {
+    buffer->mCount.store(0, std::memory_order_relaxed);
+    buffer->mDropped.store(0, std::memory_order_relaxed);
+  }
+}
+
+bool Trace::dump(const std::string &path) {
+  Registry &r = registry();
+  std::lock_guard<std::mutex> lock(r.mMutex);
+  FILE *file = std::fopen(path.c_str(), "w");
+  if (!file) {
+    LOG_INFO("TRACE: can't write " << path);
+    return false;
+  }
+  // Times are from the first event
+  uint64_t origin = UINT64_MAX;
+  int dropped = 0;
+  std::set<int> threads;
+  for (auto &buffer : r.mBuffers) {
+    const int count = buffer->mCount.load(std::memory_order_acquire);
+    for (int i = 0; i < count; ++i) {
+      origin = std::min(origin, buffer->mEvents[i].start);
+      threads.insert(buffer->mEvents[i].thread);
+    }
+    dropped += buffer->mDropped.load(std::memory_order_relaxed);
+  }
+
+  std::fprintf(file, "{\"traceEvents\":[\n");
+  bool first = true;
+  for (int thread : threads) {
+    std::fprintf(file,
+                 "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                 "\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                 first ? "" : ",\n", thread, thread);
+    first = false;
+  }
+  for (auto &buffer : r.mBuffers) {
+    const int count = buffer->mCount.load(std::memory_order_acquire);
+    for (int i = 0; i < count; ++i) {
+      const Event &e = buffer->mEvents[i];
+      std::fprintf(file,
+                   "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                   "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"lane\":%d",
+                   first ? "" : ",\n", e.name, e.thread,
+                   (e.start - origin) / 1000.0, (e.end - e.start) / 1000.0,
+                   buffer->mLane);
+      first = false;
+      if (e.step >= 0)
+        std::fprintf(file, ",\"step\":%d", e.step);
+      if (e.block >= 0)
+        std::fprintf(file, ",\"block\":%d", e.block);
+      std::fprintf(file, "}}");
+    }
+  }
+  std::fprintf(file, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{"
+                     "\"dropped\":%d}}\n",
+               dropped);
+  const bool ok = std::fclose(file) == 0;
+  LOG_INFO("TRACE: wrote " << path << " dropped: " << dropped);
+  return ok;
+}
+
+} // namespace Cave
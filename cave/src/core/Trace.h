@@ -0,0 +1,71 @@
+#ifndef CAVE_TRACE_H
+#define CAVE_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace Cave {
+
+//
+// Optional timeline of the generation stages, written as Chrome trace
+// JSON (open it in chrome://tracing or ui.perfetto.dev).
+//
+// Each thread appends to its own fixed size buffer (no locks, events past
+// the end are dropped). Buffers are handed on to the next thread once
+// their thread ends. Each event keeps the thread that recorded it, as a
+// number given to each OS thread when it first records (parallelFor starts
+// new threads every call, so there can be many), which is its "tid" in the
+// trace. The buffer is in its args as "lane".
+//
+// Off by default. Setting the CAVE_TRACE environment variable to a file
+// name turns it on at startup and dumps to that file at exit.
+//
+class Trace {
+public:
+  static void setEnabled(bool enabled);
+  static bool isEnabled() { return sEnabled.load(std::memory_order_relaxed); }
+
+  // Writes every event so far. Only call it while nothing is generating.
+  // Returns false if the file couldn't be written.
+  static bool dump(const std::string &path);
+  // Forget the events so far (same rule as dump)
+  static void clear();
+
+  // For TraceScope
+  static uint64_t now();
+  static void record(const char *name, int step, int block, uint64_t start,
+                     uint64_t end);
+
+private:
+  static std::atomic<bool> sEnabled;
+};
+
+//
+// Records the time from construction to destruction as one event.
+// name must be a string literal. step (e.g. the GenerationStep) and block
+// (e.g. the band) are shown in the event's args if >= 0.
+//
+class TraceScope {
+public:
+  explicit TraceScope(const char *name, int step = -1, int block = -1)
+      : mName(Trace::isEnabled() ? name : nullptr), mStep(step),
+        mBlock(block), mStart(mName ? Trace::now() : 0) {}
+  ~TraceScope() {
+    if (mName)
+      Trace::record(mName, mStep, mBlock, mStart, Trace::now());
+  }
+
+  TraceScope(const TraceScope &) = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+  const char *mName;
+  int mStep;
+  int mBlock;
+  uint64_t mStart;
+};
+
+} // namespace Cave
+
+#endif
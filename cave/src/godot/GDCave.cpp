@@ -1,13 +1,81 @@
 #include "GDCave.hpp"
 #include "core/Cave.h"
+#include "core/CollisionBuilder.h"
+#include "core/LayerGenerator.h"
 #include "core/TileTypes.h"
+#include "core/Trace.h"
+#include <godot_cpp/classes/collision_polygon2d.hpp>
+#include <godot_cpp/classes/collision_shape2d.hpp>
+#include <godot_cpp/classes/performance.hpp>
+#include <godot_cpp/classes/project_settings.hpp>
+#include <godot_cpp/classes/rectangle_shape2d.hpp>
+#include <godot_cpp/classes/tile_set.hpp>
 #include <godot_cpp/core/class_db.hpp>
+#include <godot_cpp/core/object.hpp>
 #include <godot_cpp/variant/utility_functions.hpp>
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <set>
 
 #include "Debug.h"
 
 using namespace godot;
 
+namespace {
+
+// What the Performance monitors read. The lock covers the set and each
+// GDCave's m_cache/m_queue so they can't go while being read.
+struct Monitors {
+    std::mutex mutex;
+    std::set<GDCave*> caves;
+    std::atomic<float> stageMs[Cave::STAGE_COUNT] = {};
+    std::atomic<int64_t> tilesUploaded{0};
+};
+
+Monitors& monitors() {
+    static Monitors m;
+    return m;
+}
+
+const char* const STAGE_MONITORS[Cave::STAGE_COUNT] = {
+    "GDCave/noise_ms", "GDCave/ca_ms", "GDCave/fixup_ms",
+    "GDCave/rooms_ms", "GDCave/join_ms", "GDCave/smooth_ms",
+};
+
+// Calls put(pos, atlas) for each TileMapLayer cell that map cell x,y covers
+template <typename Put>
+void for_each_tile(const Cave::CaveInfo& info, int mapW, int mapH, int x, int y, Vector2i tile, Put put) {
+    // If it's on a side border then we insert borderWidth cells
+    if ((x == 0) || (x == mapW - 1)) {
+        for (int i = 0; i < info.mBorderWidth; ++i) {
+            LOG_INFO("SIDE BORDER " << x+i << "," << y << " tile=" << tile.x << "," << tile.y);
+            put(Vector2i(x+i, y), tile);
+        }
+    }
+    // If it's on top/bottom border then we insert borderHeight cells
+    else if ((y == 0) || (y == mapH - 1)) {
+        for (int i = 0; i < info.mBorderHeight; ++i) {
+            LOG_INFO("TOP/BOTTOM BORDER " << x << "," << y+i << " tile=" << tile.x << "," << tile.y);
+            put(Vector2i(x, y+i), tile);
+        }
+    }
+    // Otherwise we insert a cellW x cellH tile
+    else {
+        int mapX = info.mBorderWidth + (x * info.mCellWidth);
+        int mapY = info.mBorderHeight + (y * info.mCellHeight);
+        for (int cy = 0; cy < info.mCellHeight; ++cy) {
+            for (int cx = 0; cx < info.mCellWidth; ++cx) {
+                // For some reason Need to use -1,-1 for floor
+                Vector2i t = (tile.x < 0) ? tile : Vector2i(tile.x+cx, tile.y+cy);
+                put(Vector2i(mapX + cx, mapY + cy), t);
+            }
+        }
+    }
+}
+
+}
+
 void GDCave::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("set_cave_size", "caveSize"), &GDCave::setCaveSize);
 	ClassDB::bind_method(D_METHOD("set_border_cell_size", "cells"), &GDCave::setBorderCellSize);
@@ -21,15 +89,137 @@ void GDCave::_bind_methods() {
 	ClassDB::bind_method(D_METHOD("set_freq", "freq"), &GDCave::setFreq);
 	ClassDB::bind_method(D_METHOD("set_amp", "amp"), &GDCave::setAmp);
 	ClassDB::bind_method(D_METHOD("set_generations", "gens"), &GDCave::setGenerations);
+	ClassDB::bind_method(D_METHOD("set_pyramid", "scale", "refineGens"), &GDCave::setPyramid, DEFVAL(Array()));
+	ClassDB::bind_method(D_METHOD("set_detect_oscillation", "detect"), &GDCave::setDetectOscillation);
+	ClassDB::bind_method(D_METHOD("set_min_room_size", "cells"), &GDCave::setMinRoomSize);
+	ClassDB::bind_method(D_METHOD("set_threads", "threads"), &GDCave::setThreads);
+	ClassDB::bind_method(D_METHOD("set_acceptance", "minFloorRatio", "maxFloorRatio", "minRooms", "maxRooms", "maxTunnels"), &GDCave::setAcceptance);
+	ClassDB::bind_method(D_METHOD("set_room_graph", "buildRoomGraph"), &GDCave::setRoomGraph);
+	ClassDB::bind_method(D_METHOD("set_overview", "levels", "threshold"), &GDCave::setOverview, DEFVAL(-1));
+	ClassDB::bind_method(D_METHOD("set_view_streaming", "enabled", "chunkCells", "margin"), &GDCave::setViewStreaming, DEFVAL(16), DEFVAL(1));
+	ClassDB::bind_method(D_METHOD("set_cache", "maxBytes", "directory"), &GDCave::setCache, DEFVAL(String()));
+	ClassDB::bind_method(D_METHOD("set_pregeneration", "workers", "maxBytes"), &GDCave::setPregeneration);
+	ClassDB::bind_method(D_METHOD("pregenerate", "seed", "priority"), &GDCave::pregenerate, DEFVAL(0));
 	ClassDB::bind_method(D_METHOD("make_cave", "pTileMap", "layer", "seed"), &GDCave::make_cave);
+	ClassDB::bind_method(D_METHOD("make_cave_layers", "caves", "tileMaps", "layer", "seed"), &GDCave::make_cave_layers);
+	ClassDB::bind_method(D_METHOD("update_view", "rect"), &GDCave::update_view);
+	ClassDB::bind_method(D_METHOD("get_live_chunk_count"), &GDCave::getLiveChunkCount);
+	ClassDB::bind_method(D_METHOD("get_generation_stats"), &GDCave::getGenerationStats);
+	ClassDB::bind_method(D_METHOD("get_cache_stats"), &GDCave::getCacheStats);
+	ClassDB::bind_method(D_METHOD("clear_cache"), &GDCave::clearCache);
+	ClassDB::bind_method(D_METHOD("get_pregeneration_stats"), &GDCave::getPregenerationStats);
+	ClassDB::bind_method(D_METHOD("cancel"), &GDCave::cancel);
+	ClassDB::bind_method(D_METHOD("set_tracing", "enabled"), &GDCave::setTracing);
+	ClassDB::bind_method(D_METHOD("dump_trace", "path"), &GDCave::dumpTrace);
+	ClassDB::bind_method(D_METHOD("get_room_cell_counts"), &GDCave::getRoomCellCounts);
+	ClassDB::bind_method(D_METHOD("get_room_bounds"), &GDCave::getRoomBounds);
+	ClassDB::bind_method(D_METHOD("get_room_centroids"), &GDCave::getRoomCentroids);
+	ClassDB::bind_method(D_METHOD("get_room_edges"), &GDCave::getRoomEdges);
+	ClassDB::bind_method(D_METHOD("get_room_labels"), &GDCave::getRoomLabels);
+	ClassDB::bind_method(D_METHOD("compute_distance_field", "sources"), &GDCave::computeDistanceField);
+	ClassDB::bind_method(D_METHOD("update_distance_sources", "sources"), &GDCave::updateDistanceSources);
+	ClassDB::bind_method(D_METHOD("get_flow_field"), &GDCave::getFlowField);
+	ClassDB::bind_method(D_METHOD("get_wall_distances"), &GDCave::getWallDistances);
+	ClassDB::bind_method(D_METHOD("get_overview_level_count"), &GDCave::getOverviewLevelCount);
+	ClassDB::bind_method(D_METHOD("get_overview", "level"), &GDCave::getOverview);
+	ClassDB::bind_method(D_METHOD("get_overview_image", "level"), &GDCave::getOverviewImage);
+	ClassDB::bind_method(D_METHOD("build_collision", "pTileMap", "pBody"), &GDCave::build_collision);
 }
 
 GDCave::GDCave() {
     m_floor_tile = Vector2i(0,0);
     m_wall_tile = Vector2i(0,1);
+    std::lock_guard<std::mutex> lock(monitors().mutex);
+    monitors().caves.insert(this);
+}
+
+GDCave::~GDCave() {
+    std::lock_guard<std::mutex> lock(monitors().mutex);
+    monitors().caves.erase(this);
+}
+
+void GDCave::add_monitors() {
+    Performance* performance = Performance::get_singleton();
+    for (int stage = 0; stage < Cave::STAGE_COUNT; ++stage) {
+        Array args;
+        args.push_back(stage);
+        performance->add_custom_monitor(STAGE_MONITORS[stage], callable_mp_static(&GDCave::monitor_stage_ms), args);
+    }
+    Array yes;
+    yes.push_back(true);
+    Array no;
+    no.push_back(false);
+    performance->add_custom_monitor("GDCave/tiles_uploaded", callable_mp_static(&GDCave::monitor_tiles_uploaded));
+    performance->add_custom_monitor("GDCave/cache_hits", callable_mp_static(&GDCave::monitor_cache), yes);
+    performance->add_custom_monitor("GDCave/cache_misses", callable_mp_static(&GDCave::monitor_cache), no);
+    performance->add_custom_monitor("GDCave/jobs_queued", callable_mp_static(&GDCave::monitor_jobs), no);
+    performance->add_custom_monitor("GDCave/jobs_running", callable_mp_static(&GDCave::monitor_jobs), yes);
+    performance->add_custom_monitor("GDCave/native_bytes", callable_mp_static(&GDCave::monitor_native_bytes));
+}
+
+void GDCave::remove_monitors() {
+    Performance* performance = Performance::get_singleton();
+    if (!performance) {
+        return;
+    }
+    for (const char* name : STAGE_MONITORS) {
+        performance->remove_custom_monitor(name);
+    }
+    for (const char* name : {"GDCave/tiles_uploaded", "GDCave/cache_hits", "GDCave/cache_misses",
+                             "GDCave/jobs_queued", "GDCave/jobs_running", "GDCave/native_bytes"}) {
+        performance->remove_custom_monitor(name);
+    }
+}
+
+// Of the last cave generated (not the ones from the cache)
+double GDCave::monitor_stage_ms(int stage) {
+    return monitors().stageMs[stage].load(std::memory_order_relaxed);
+}
+
+// By the last make_cave or update_view
+int64_t GDCave::monitor_tiles_uploaded() {
+    return monitors().tilesUploaded.load(std::memory_order_relaxed);
+}
+
+int64_t GDCave::monitor_cache(bool hits) {
+    std::lock_guard<std::mutex> lock(monitors().mutex);
+    int64_t total = 0;
+    for (GDCave* cave : monitors().caves) {
+        if (cave->m_cache) {
+            const Cave::CacheStats stats = cave->m_cache->getStats();
+            total += hits ? stats.mHits : stats.mMisses;
+        }
+    }
+    return total;
+}
+
+int64_t GDCave::monitor_jobs(bool running) {
+    std::lock_guard<std::mutex> lock(monitors().mutex);
+    int64_t total = 0;
+    for (GDCave* cave : monitors().caves) {
+        if (cave->m_queue) {
+            const Cave::QueueStats stats = cave->m_queue->getStats();
+            total += running ? stats.mRunning : stats.mQueued;
+        }
+    }
+    return total;
 }
 
-GDCave::~GDCave() {}
+// The maps, room graphs and overviews plus the cached and pregenerated caves
+int64_t GDCave::monitor_native_bytes() {
+    std::lock_guard<std::mutex> lock(monitors().mutex);
+    int64_t total = 0;
+    for (GDCave* cave : monitors().caves) {
+        total += cave->m_native_bytes.load(std::memory_order_relaxed);
+        if (cave->m_cache) {
+            total += cave->m_cache->getStats().mBytes;
+        }
+        if (cave->m_queue) {
+            total += cave->m_queue->getStats().mBytes;
+        }
+    }
+    return total;
+}
 
 GDCave* GDCave::setCaveSize(Vector2i caveSize) {
 	m_cave_info.mCaveWidth = caveSize.x;
@@ -91,10 +281,570 @@ GDCave* GDCave::setAmp(float amp) {
 }
 
 GDCave* GDCave::setGenerations(const godot::Array& gens) {
-    m_gen_params.mGenerations.clear();
+    m_gen_params.mGenerations = to_steps(gens);
+    return this;
+}
+
+// scale <= 1 = off, empty refineGens = the default majority smooth
+GDCave* GDCave::setPyramid(int scale, const godot::Array& refineGens) {
+	m_gen_params.mPyramidScale = scale;
+	m_gen_params.mRefineGenerations = to_steps(refineGens);
+	return this;
+}
+
+GDCave* GDCave::setDetectOscillation(bool detect) {
+	m_gen_params.mDetectOscillation = detect;
+	return this;
+}
+
+GDCave* GDCave::setMinRoomSize(int cells) {
+	m_gen_params.mMinRoomSize = cells;
+	return this;
+}
+
+// 0 = all cores, 1 = no worker threads
+GDCave* GDCave::setThreads(int threads) {
+	m_gen_params.mThreads = threads;
+	return this;
+}
+
+// max < 0 = no limit
+GDCave* GDCave::setAcceptance(float minFloorRatio, float maxFloorRatio, int minRooms, int maxRooms, int maxTunnels) {
+	m_gen_params.mAccept.mMinFloorRatio = minFloorRatio;
+	m_gen_params.mAccept.mMaxFloorRatio = maxFloorRatio;
+	m_gen_params.mAccept.mMinRooms = minRooms;
+	m_gen_params.mAccept.mMaxRooms = maxRooms;
+	m_gen_params.mAccept.mMaxTunnels = maxTunnels;
+	return this;
+}
+
+GDCave* GDCave::setRoomGraph(bool buildRoomGraph) {
+	m_build_room_graph = buildRoomGraph;
+	return this;
+}
+
+// threshold < 0 gives 0..255 wall coverage, otherwise just 0 or 255
+GDCave* GDCave::setOverview(int levels, int threshold) {
+	m_overview_levels = levels;
+	m_overview_threshold = threshold;
+	return this;
+}
+
+// chunkCells x chunkCells TileMap cells per chunk, margin = chunks kept
+// round the view. Changing it drops the chunks already in the layer.
+GDCave* GDCave::setViewStreaming(bool enabled, int chunkCells, int margin) {
+	release_view();
+	m_view_streaming = enabled;
+	m_chunk_cells = std::max(1, chunkCells);
+	m_chunk_margin = std::max(0, margin);
+	return this;
+}
+
+// maxBytes <= 0 turns the cache off. With a directory the caves are kept
+// there too (e.g. "user://cave_cache", which must already exist).
+GDCave* GDCave::setCache(int64_t maxBytes, const String& directory) {
+	std::lock_guard<std::mutex> lock(monitors().mutex);
+	if (maxBytes <= 0) {
+		m_cache.reset();
+		return this;
+	}
+	std::string dir;
+	if (!directory.is_empty()) {
+		dir = ProjectSettings::get_singleton()->globalize_path(directory).utf8().get_data();
+	}
+	m_cache = std::make_unique<Cave::CaveCache>(maxBytes, dir);
+	return this;
+}
+
+// workers <= 0 turns it off (waiting for any running job). maxBytes caps
+// the finished caves waiting for make_cave plus the ones being made.
+GDCave* GDCave::setPregeneration(int workers, int64_t maxBytes) {
+	// Outside the lock, it waits for the running jobs
+	std::unique_ptr<Cave::GenerationQueue> old;
+	{
+		std::lock_guard<std::mutex> lock(monitors().mutex);
+		old = std::move(m_queue);
+	}
+	old.reset();
+	std::lock_guard<std::mutex> lock(monitors().mutex);
+	if (workers > 0) {
+		m_queue = std::make_unique<Cave::GenerationQueue>(workers, std::max<int64_t>(0, maxBytes));
+	}
+	return this;
+}
+
+bool GDCave::pregenerate(int seed, int priority) {
+	if (!m_queue) {
+		UtilityFunctions::push_warning("pregenerate needs set_pregeneration first");
+		return false;
+	}
+	Cave::GenerationParams params = m_gen_params;
+	params.seed = seed;
+	m_queue->enqueue(m_cave_info, params, m_build_room_graph, priority);
+	return true;
+}
+
+bool GDCave::make_cave(TileMapLayer* pTileMap, int layer, int seed)
+{
+    m_gen_params.seed = seed;
+    m_cancel.reset();
+
+    m_room_graph.clear();
+    m_distance_field.reset();
+    m_overview.reset();
+    // From the cache, the pregeneration queue (waiting if it is being made)
+    // or generated now
+    Cave::CachedCave cached;
+    const uint64_t key = Cave::CaveCache::makeKey(m_cave_info, m_gen_params);
+    const bool fromCache = m_cache && m_cache->get(key, m_build_room_graph, cached);
+    const bool fromQueue = !fromCache && m_queue && m_queue->take(key, m_build_room_graph, cached);
+    if (fromCache || fromQueue) {
+        m_tile_map = std::move(cached.mTileMap);
+        m_stats = cached.mStats;
+        if (m_build_room_graph) {
+            m_room_graph = std::move(cached.mRoomGraph);
+        }
+    } else {
+        Cave::Cave cave(m_cave_info, m_gen_params);
+        cave.setCancelToken(&m_cancel);
+        m_tile_map = cave.generate(m_build_room_graph ? &m_room_graph : nullptr);
+        m_stats = cave.getStats();
+    }
+    if (!fromCache) {
+        for (int stage = 0; stage < Cave::STAGE_COUNT; ++stage) {
+            monitors().stageMs[stage].store(m_stats.mStageMs[stage], std::memory_order_relaxed);
+        }
+    }
+    if (m_cache && !fromCache && m_stats.mRejection != Cave::CANCELLED) {
+        cached.mTileMap = m_tile_map;
+        cached.mStats = m_stats;
+        cached.mHasRoomGraph = m_build_room_graph;
+        cached.mRoomGraph = m_room_graph;
+        m_cache->put(key, cached);
+    }
+    if (m_stats.mRejection != Cave::ACCEPTED) {
+        LOG_INFO("CAVE REJECTED: " << m_stats.mRejection);
+        // Any live chunks are the previous cave, leave them be
+        m_view_current = false;
+        return false;
+    }
+    if (m_overview_levels > 0) {
+        m_overview = std::make_unique<Cave::OverviewMap>(m_tile_map, m_cave_info, m_overview_levels, m_overview_threshold);
+    }
+    update_native_bytes();
+    release_view();
+    if (m_view_streaming) {
+        // Nothing goes in the layer until update_view
+        m_view_tile_map_id = pTileMap ? pTileMap->get_instance_id() : 0;
+        m_view_layer = layer;
+        m_view_info = m_cave_info;
+        m_view_map_w = m_tile_map[0].size();
+        m_view_map_h = m_tile_map.size();
+        m_view_current = true;
+    } else {
+        m_view_current = false;
+        copy_core_to_tilemap(pTileMap, layer, m_tile_map);
+        end_upload();
+    }
+    LOG_INFO("CAVE DONE");
+    return true;
+}
+
+bool GDCave::make_cave_layers(const Array& caves, const Array& tileMaps, int layer, int seed)
+{
+    if (caves.is_empty() || caves.size() != tileMaps.size()) {
+        UtilityFunctions::push_error("make_cave_layers needs a TileMapLayer per GDCave");
+        return false;
+    }
+    std::vector<GDCave*> layers;
+    std::vector<TileMapLayer*> targets;
+    std::vector<Cave::GenerationParams> params;
+    for (int i = 0; i < caves.size(); ++i) {
+        GDCave* cave = Object::cast_to<GDCave>(caves[i]);
+        TileMapLayer* pTileMap = Object::cast_to<TileMapLayer>(tileMaps[i]);
+        if (!cave || !pTileMap) {
+            UtilityFunctions::push_error("make_cave_layers: caves must be GDCaves and tileMaps TileMapLayers");
+            return false;
+        }
+        // Only the size goes into the generation, the border and cell size
+        // are just how each is put in its layer
+        if (!layers.empty() && (cave->m_cave_info.mCaveWidth != layers[0]->m_cave_info.mCaveWidth ||
+                                cave->m_cave_info.mCaveHeight != layers[0]->m_cave_info.mCaveHeight)) {
+            UtilityFunctions::push_error("make_cave_layers: every GDCave must have the same cave size");
+            return false;
+        }
+        layers.push_back(cave);
+        targets.push_back(pTileMap);
+        cave->m_gen_params.seed = seed;
+        params.push_back(cave->m_gen_params);
+    }
+    // Any of the layers' cancel() stops the lot (this one's is m_cancel)
+    m_cancel.reset();
+    for (GDCave* cave : layers) {
+        if (cave != this) {
+            cave->m_layers_cancel.store(&m_cancel);
+        }
+    }
+
+    // As make_cave, each layer from its GDCave's cache or pregeneration
+    // queue if it is there, the rest generated together
+    std::vector<Cave::CachedCave> cached(layers.size());
+    std::vector<uint64_t> keys(layers.size());
+    std::vector<bool> fromCache(layers.size(), false);
+    std::vector<bool> fromQueue(layers.size(), false);
+    std::vector<size_t> pending;
+    std::vector<Cave::GenerationParams> pendingParams;
+    bool anyRoomGraph = false;
+    bool anyQueued = false;
+    float stageMs[Cave::STAGE_COUNT] = {};
+    for (size_t i = 0; i < layers.size(); ++i) {
+        GDCave* cave = layers[i];
+        keys[i] = Cave::CaveCache::makeKey(cave->m_cave_info, params[i]);
+        fromCache[i] = cave->m_cache && cave->m_cache->get(keys[i], cave->m_build_room_graph, cached[i]);
+        fromQueue[i] = !fromCache[i] && cave->m_queue &&
+                       cave->m_queue->take(keys[i], cave->m_build_room_graph, cached[i]);
+        if (fromQueue[i]) {
+            anyQueued = true;
+            for (int stage = 0; stage < Cave::STAGE_COUNT; ++stage) {
+                stageMs[stage] += cached[i].mStats.mStageMs[stage];
+            }
+        }
+        if (!fromCache[i] && !fromQueue[i]) {
+            pending.push_back(i);
+            pendingParams.push_back(params[i]);
+            anyRoomGraph = anyRoomGraph || cave->m_build_room_graph;
+        }
+    }
+    if (!pending.empty()) {
+        Cave::LayerGenerator generator(layers[0]->m_cave_info, pendingParams);
+        generator.setCancelToken(&m_cancel);
+        std::vector<Cave::RoomGraph> roomGraphs;
+        std::vector<Cave::TileMap> maps = generator.generate(anyRoomGraph ? &roomGraphs : nullptr);
+        LOG_INFO("CAVE LAYERS: " << pending.size() << " of " << layers.size()
+                                 << " generated, shared steps: " << generator.getSharedSteps());
+        for (size_t p = 0; p < pending.size(); ++p) {
+            Cave::CachedCave& generated = cached[pending[p]];
+            generated.mTileMap = std::move(maps[p]);
+            generated.mStats = generator.getStats(p);
+            generated.mHasRoomGraph = layers[pending[p]]->m_build_room_graph;
+            if (generated.mHasRoomGraph) {
+                generated.mRoomGraph = std::move(roomGraphs[p]);
+            }
+        }
+        for (int stage = 0; stage < Cave::STAGE_COUNT; ++stage) {
+            stageMs[stage] += generator.getStageMs(Cave::Stage(stage));
+        }
+    }
+    // What was done for this call, so the shared work once
+    if (!pending.empty() || anyQueued) {
+        for (int stage = 0; stage < Cave::STAGE_COUNT; ++stage) {
+            monitors().stageMs[stage].store(stageMs[stage], std::memory_order_relaxed);
+        }
+    }
+
+    for (GDCave* cave : layers) {
+        cave->m_layers_cancel.store(nullptr);
+    }
+
+    bool allAccepted = true;
+    for (size_t i = 0; i < layers.size(); ++i) {
+        GDCave* cave = layers[i];
+        cave->m_stats = cached[i].mStats;
+        cave->m_room_graph.clear();
+        cave->m_distance_field.reset();
+        cave->m_overview.reset();
+        if (cave->m_cache && !fromCache[i] && cave->m_stats.mRejection != Cave::CANCELLED) {
+            cave->m_cache->put(keys[i], cached[i]);
+        }
+        cave->m_tile_map = std::move(cached[i].mTileMap);
+        if (cave->m_build_room_graph) {
+            cave->m_room_graph = std::move(cached[i].mRoomGraph);
+        }
+        if (cave->m_stats.mRejection != Cave::ACCEPTED) {
+            LOG_INFO("CAVE LAYER " << i << " REJECTED: " << cave->m_stats.mRejection);
+            cave->m_view_current = false;
+            allAccepted = false;
+            continue;
+        }
+        if (cave->m_overview_levels > 0) {
+            cave->m_overview = std::make_unique<Cave::OverviewMap>(cave->m_tile_map, cave->m_cave_info,
+                                                                   cave->m_overview_levels, cave->m_overview_threshold);
+        }
+        cave->update_native_bytes();
+        cave->release_view();
+        cave->m_view_current = false;
+    }
+
+    // Every layer is made before any goes in, then each goes in with one call
+    int64_t tiles = 0;
+    for (size_t i = 0; i < layers.size(); ++i) {
+        GDCave* cave = layers[i];
+        if (cave->m_stats.mRejection != Cave::ACCEPTED) {
+            continue;
+        }
+        if (!cave->upload_batched(targets[i], layer)) {
+            cave->copy_core_to_tilemap(targets[i], layer, cave->m_tile_map);
+        }
+        tiles += cave->m_tiles_set;
+        cave->m_tiles_set = 0;
+    }
+    monitors().tilesUploaded.store(tiles, std::memory_order_relaxed);
+    LOG_INFO("CAVE LAYERS DONE");
+    return allAccepted;
+}
+
+// rect is in TileMapLayer coords, e.g. from local_to_map of the camera
+// corners. An empty rect erases every chunk.
+int GDCave::update_view(Rect2i rect) {
+    if (!m_view_streaming || !m_view_current) {
+        return 0;
+    }
+    TileMapLayer* pTileMap = Object::cast_to<TileMapLayer>(ObjectDB::get_instance(m_view_tile_map_id));
+    if (!pTileMap) {
+        UtilityFunctions::push_warning("update_view needs a make_cave with set_view_streaming on");
+        return 0;
+    }
+    m_chunks_across = (m_view_map_w + m_chunk_cells - 1) / m_chunk_cells;
+    const int chunksDown = (m_view_map_h + m_chunk_cells - 1) / m_chunk_cells;
+    if (m_chunk_live.empty()) {
+        m_chunk_live.assign(m_chunks_across * chunksDown, 0);
+    }
+
+    // Wanted chunks (inclusive), none for an empty rect
+    int cx0 = 0, cy0 = 0, cx1 = -1, cy1 = -1;
+    if (rect.size.x > 0 && rect.size.y > 0) {
+        auto floorDiv = [](int a, int b) { return (a >= 0) ? a / b : -((-a + b - 1) / b); };
+        auto toChunk = [&](int tile, int border, int cellSize, int cells) {
+            int cell = floorDiv(tile - border, std::max(1, cellSize));
+            return std::clamp(cell, 0, cells - 1) / m_chunk_cells;
+        };
+        const Vector2i end = rect.get_end() - Vector2i(1, 1);
+        cx0 = std::max(0, toChunk(rect.position.x, m_view_info.mBorderWidth, m_view_info.mCellWidth, m_view_map_w) - m_chunk_margin);
+        cy0 = std::max(0, toChunk(rect.position.y, m_view_info.mBorderHeight, m_view_info.mCellHeight, m_view_map_h) - m_chunk_margin);
+        cx1 = std::min(m_chunks_across - 1, toChunk(end.x, m_view_info.mBorderWidth, m_view_info.mCellWidth, m_view_map_w) + m_chunk_margin);
+        cy1 = std::min(chunksDown - 1, toChunk(end.y, m_view_info.mBorderHeight, m_view_info.mCellHeight, m_view_map_h) + m_chunk_margin);
+    }
+
+    int changed = 0;
+    std::vector<int> live;
+    for (int chunk : m_live_chunks) {
+        const int cx = chunk % m_chunks_across;
+        const int cy = chunk / m_chunks_across;
+        if (cx < cx0 || cx > cx1 || cy < cy0 || cy > cy1) {
+            put_chunk(pTileMap, chunk, true);
+            m_chunk_live[chunk] = 0;
+            ++changed;
+        } else {
+            live.push_back(chunk);
+        }
+    }
+    for (int cy = cy0; cy <= cy1; ++cy) {
+        for (int cx = cx0; cx <= cx1; ++cx) {
+            const int chunk = cy * m_chunks_across + cx;
+            if (!m_chunk_live[chunk]) {
+                put_chunk(pTileMap, chunk, false);
+                m_chunk_live[chunk] = 1;
+                live.push_back(chunk);
+                ++changed;
+            }
+        }
+    }
+    m_live_chunks.swap(live);
+    end_upload();
+    return changed;
+}
+
+int GDCave::getLiveChunkCount() const {
+    return m_live_chunks.size();
+}
+
+// { "rejection", "floor_ratio", "room_count", "tunnel_count",
+//   "steps": [ { "reps_run", "converged", "oscillating", "changes" } ] }
+Dictionary GDCave::getGenerationStats() const {
+    Array steps;
+    for (const Cave::StepStats& step : m_stats.mSteps) {
+        Dictionary d;
+        d["reps_run"] = step.mRepsRun;
+        d["converged"] = step.mConverged;
+        d["oscillating"] = step.mOscillating;
+        d["changes"] = to_packed(step.mChanges);
+        steps.push_back(d);
+    }
+    Dictionary stats;
+    stats["rejection"] = (int)m_stats.mRejection;
+    stats["floor_ratio"] = m_stats.mFloorRatio;
+    stats["room_count"] = m_stats.mRoomCount;
+    stats["tunnel_count"] = m_stats.mTunnelCount;
+    stats["steps"] = steps;
+    // Of the generation that made it (zero if read from a cache file)
+    PackedFloat32Array stageMs;
+    for (float ms : m_stats.mStageMs) {
+        stageMs.push_back(ms);
+    }
+    stats["stage_ms"] = stageMs;
+    return stats;
+}
+
+// { "hits", "disk_hits", "misses", "entries", "bytes" }, empty if off
+Dictionary GDCave::getCacheStats() const {
+    Dictionary stats;
+    if (m_cache) {
+        const Cave::CacheStats cacheStats = m_cache->getStats();
+        stats["hits"] = cacheStats.mHits;
+        stats["disk_hits"] = cacheStats.mDiskHits;
+        stats["misses"] = cacheStats.mMisses;
+        stats["entries"] = cacheStats.mEntries;
+        stats["bytes"] = (int64_t)cacheStats.mBytes;
+    }
+    return stats;
+}
+
+// { "queued", "running", "finished", "bytes" }, empty if off
+Dictionary GDCave::getPregenerationStats() const {
+    Dictionary stats;
+    if (m_queue) {
+        const Cave::QueueStats queueStats = m_queue->getStats();
+        stats["queued"] = queueStats.mQueued;
+        stats["running"] = queueStats.mRunning;
+        stats["finished"] = queueStats.mFinished;
+        stats["bytes"] = (int64_t)queueStats.mBytes;
+    }
+    return stats;
+}
+
+void GDCave::cancel() {
+    m_cancel.cancel();
+    if (Cave::CancelToken* layers = m_layers_cancel.load()) {
+        layers->cancel();
+    }
+    if (m_queue) {
+        m_queue->cancel();
+    }
+}
+
+void GDCave::setTracing(bool enabled) {
+    Cave::Trace::setEnabled(enabled);
+}
+
+// Writes the events so far then starts again. Not while generating.
+bool GDCave::dumpTrace(const String& path) {
+    const std::string file = ProjectSettings::get_singleton()->globalize_path(path).utf8().get_data();
+    const bool ok = Cave::Trace::dump(file);
+    Cave::Trace::clear();
+    return ok;
+}
+
+// Just memory, files in the cache directory stay
+void GDCave::clearCache() {
+    if (m_cache) {
+        m_cache->clear();
+    }
+}
+
+PackedInt32Array GDCave::getRoomCellCounts() const {
+    PackedInt32Array counts;
+    counts.resize(m_room_graph.mRooms.size());
+    for (int i = 0; i < m_room_graph.mRooms.size(); ++i) {
+        counts.set(i, m_room_graph.mRooms[i].mCellCount);
+    }
+    return counts;
+}
+
+// x,y,w,h per room
+PackedInt32Array GDCave::getRoomBounds() const {
+    PackedInt32Array bounds;
+    bounds.resize(m_room_graph.mRooms.size() * 4);
+    int i = 0;
+    for (const Cave::RoomInfo& room : m_room_graph.mRooms) {
+        bounds.set(i++, room.mMin.x);
+        bounds.set(i++, room.mMin.y);
+        bounds.set(i++, room.mMax.x - room.mMin.x + 1);
+        bounds.set(i++, room.mMax.y - room.mMin.y + 1);
+    }
+    return bounds;
+}
+
+PackedVector2Array GDCave::getRoomCentroids() const {
+    PackedVector2Array centroids;
+    centroids.resize(m_room_graph.mRooms.size());
+    for (int i = 0; i < m_room_graph.mRooms.size(); ++i) {
+        const Cave::RoomInfo& room = m_room_graph.mRooms[i];
+        centroids.set(i, Vector2(room.mCentroidX, room.mCentroidY));
+    }
+    return centroids;
+}
+
+// room1, room2, startX, startY, dirX, dirY, thickness per tunnel
+PackedInt32Array GDCave::getRoomEdges() const {
+    PackedInt32Array edges;
+    edges.resize(m_room_graph.mEdges.size() * 7);
+    int i = 0;
+    for (const Cave::RoomEdge& edge : m_room_graph.mEdges) {
+        edges.set(i++, edge.mRoom1);
+        edges.set(i++, edge.mRoom2);
+        edges.set(i++, edge.mStart.x);
+        edges.set(i++, edge.mStart.y);
+        edges.set(i++, edge.mDir.x);
+        edges.set(i++, edge.mDir.y);
+        edges.set(i++, edge.mThickness);
+    }
+    return edges;
+}
+
+// Cave width x height room id per cell, -1 if not in a room
+PackedInt32Array GDCave::getRoomLabels() const {
+    return to_packed(m_room_graph.mLabels);
+}
+
+// The sources are an Array of Vector2i cave cells
+PackedInt32Array GDCave::computeDistanceField(const godot::Array& sources) {
+    if (m_tile_map.empty()) {
+        UtilityFunctions::push_warning("compute_distance_field called before make_cave");
+        return PackedInt32Array();
+    }
+    if (!m_distance_field) {
+        m_distance_field = std::make_unique<Cave::DistanceField>(m_tile_map, m_cave_info);
+    }
+    m_distance_field->compute(to_cave_points(sources));
+    return to_packed(m_distance_field->getDistances());
+}
+
+// Only recalculates what changed since the last compute/update
+PackedInt32Array GDCave::updateDistanceSources(const godot::Array& sources) {
+    if (!m_distance_field) {
+        return computeDistanceField(sources);
+    }
+    m_distance_field->updateSources(to_cave_points(sources));
+    return to_packed(m_distance_field->getDistances());
+}
+
+// Index into N,E,S,W,NE,SE,SW,NW per cell, 255 = no flow
+PackedByteArray GDCave::getFlowField() const {
+    PackedByteArray flow;
+    if (m_distance_field) {
+        std::vector<uint8_t> values = m_distance_field->getFlowField();
+        flow.resize(values.size());
+        memcpy(flow.ptrw(), values.data(), values.size());
+    }
+    return flow;
+}
+
+PackedInt32Array GDCave::getWallDistances() const {
+    if (m_tile_map.empty()) {
+        return PackedInt32Array();
+    }
+    if (m_distance_field) {
+        return to_packed(m_distance_field->getWallDistances());
+    }
+    return to_packed(Cave::DistanceField(m_tile_map, m_cave_info).getWallDistances());
+}
+
+std::vector<Cave::GenerationStep> GDCave::to_steps(const godot::Array& gens) {
+    std::vector<Cave::GenerationStep> steps;
     for (int i = 0; i < gens.size(); ++i) {
         Array gen = gens[i];
-        if (gen.size() == 9) {
+        // 9 values, or 14 with radius, bn_min,bn_max, sn_min,sn_max
+        if (gen.size() == 9 || gen.size() == 14) {
             Cave::GenerationStep step;
             step.b3_min = gen[0];
             step.b3_max = gen[1];
@@ -105,48 +855,160 @@ GDCave* GDCave::setGenerations(const godot::Array& gens) {
             step.s5_min = gen[6];
             step.s5_max = gen[7];
             step.reps = gen[8];
-            m_gen_params.mGenerations.push_back(step);
+            if (gen.size() == 14) {
+                step.radius = gen[9];
+                step.bn_min = gen[10];
+                step.bn_max = gen[11];
+                step.sn_min = gen[12];
+                step.sn_max = gen[13];
+            }
+            steps.push_back(step);
         } else {
             UtilityFunctions::push_warning("Invalid generation step size");
         }
     }
-    return this;
+    return steps;
 }
 
-void GDCave::make_cave(TileMapLayer* pTileMap, int layer, int seed)
-{
-    m_gen_params.seed = seed;
+std::vector<Cave::Vector2i> GDCave::to_cave_points(const godot::Array& points) {
+    std::vector<Cave::Vector2i> cavePoints;
+    for (int i = 0; i < points.size(); ++i) {
+        Vector2i p = points[i];
+        cavePoints.push_back({p.x, p.y});
+    }
+    return cavePoints;
+}
 
-    Cave::Cave cave(m_cave_info, m_gen_params);
-    const Cave::TileMap caveMap = cave.generate();
-    copy_core_to_tilemap(pTileMap, layer, caveMap);
-    LOG_INFO("CAVE DONE");
+PackedInt32Array GDCave::to_packed(const std::vector<int>& values) {
+    PackedInt32Array packed;
+    packed.resize(values.size());
+    if (!values.empty()) {
+        memcpy(packed.ptrw(), values.data(), values.size() * sizeof(int32_t));
+    }
+    return packed;
+}
+
+int GDCave::getOverviewLevelCount() const {
+    return m_overview ? m_overview->getLevelCount() : 0;
+}
+
+PackedByteArray GDCave::getOverview(int level) const {
+    PackedByteArray data;
+    if (level < 0 || level >= getOverviewLevelCount()) {
+        return data;
+    }
+    const Cave::OverviewLevel& overview = m_overview->getLevel(level);
+    data.resize(overview.mCoverage.size());
+    memcpy(data.ptrw(), overview.mCoverage.data(), overview.mCoverage.size());
+    return data;
+}
+
+// Greyscale (L8) image, white = wall
+Ref<Image> GDCave::getOverviewImage(int level) const {
+    if (level < 0 || level >= getOverviewLevelCount()) {
+        return Ref<Image>();
+    }
+    const Cave::OverviewLevel& overview = m_overview->getLevel(level);
+    return Image::create_from_data(overview.mWidth, overview.mHeight, false, Image::FORMAT_L8, getOverview(level));
+}
+
+// Returns the number of shapes added
+int GDCave::build_collision(TileMapLayer* pTileMap, StaticBody2D* pBody) {
+    if (m_tile_map.empty() || !pTileMap || !pBody || pTileMap->get_tile_set().is_null()) {
+        UtilityFunctions::push_warning("build_collision needs make_cave and a TileMapLayer with a TileSet");
+        return 0;
+    }
+    // Remove the shapes from a previous build
+    for (int i = pBody->get_child_count() - 1; i >= 0; --i) {
+        Node* child = pBody->get_child(i);
+        if (child->has_meta("gdcave_collision")) {
+            pBody->remove_child(child);
+            child->queue_free();
+        }
+    }
+
+    const Vector2 tileSize = pTileMap->get_tile_set()->get_tile_size();
+    Cave::CollisionBuilder builder(m_tile_map, m_cave_info);
+    const Cave::CollisionGeometry geometry = builder.build();
+
+    for (const Cave::CollisionRect& rect : geometry.mRects) {
+        Ref<RectangleShape2D> shape;
+        shape.instantiate();
+        shape->set_size(Vector2(rect.mW * tileSize.x, rect.mH * tileSize.y));
+        CollisionShape2D* node = memnew(CollisionShape2D);
+        node->set_shape(shape);
+        node->set_position(Vector2((rect.mX + rect.mW * 0.5f) * tileSize.x,
+                                   (rect.mY + rect.mH * 0.5f) * tileSize.y));
+        node->set_meta("gdcave_collision", true);
+        pBody->add_child(node);
+    }
+    for (const auto& poly : geometry.mPolygons) {
+        PackedVector2Array points;
+        for (const Cave::CollisionPoint& p : poly) {
+            points.push_back(Vector2(p.x * tileSize.x, p.y * tileSize.y));
+        }
+        CollisionPolygon2D* node = memnew(CollisionPolygon2D);
+        node->set_polygon(points);
+        node->set_meta("gdcave_collision", true);
+        pBody->add_child(node);
+    }
+    LOG_INFO("COLLISION DONE: " << geometry.mRects.size() << " rects " << geometry.mPolygons.size() << " polygons");
+    return geometry.mRects.size() + geometry.mPolygons.size();
 }
 
 void GDCave::copy_core_to_tilemap(TileMapLayer* pTileMap, int layer, const Cave::TileMap& caveMap) {
     LOG_INFO("COPYING CORE TO TILEMAP: " << caveMap.size() << "x" << caveMap[0].size());
-    for (int y = 0; y < caveMap.size(); ++y) {
-        for (int x = 0; x < caveMap[0].size(); ++x) {
+    const int mapW = caveMap[0].size();
+    const int mapH = caveMap.size();
+    for (int y = 0; y < mapH; ++y) {
+        for (int x = 0; x < mapW; ++x) {
             Cave::TileName tile_name = static_cast<Cave::TileName>(caveMap[y][x]);
-            Vector2i tile = map_tilename_to_vector2i(tile_name);
-            // If it's on a side border then we insert borderWidth cells
-            if ((x == 0) || (x == caveMap[0].size() - 1)) {
-                for (int i = 0; i < m_cave_info.mBorderWidth; ++i) {
-                    LOG_INFO("SIDE BORDER " << x+i << "," << y << " tile=" << tile.x << "," << tile.y);
-				    pTileMap->set_cell(Vector2i(x+i, y),layer,tile);
-                }
-            }
-            // If it's on top/bottom border then we insert borderHeight cells
-            else if ((y == 0) || (y == caveMap.size() - 1)) {
-                for (int i = 0; i < m_cave_info.mBorderHeight; ++i) {
-                    LOG_INFO("TOP/BOTTOM BORDER " << x << "," << y+i << " tile=" << tile.x << "," << tile.y);
-				    pTileMap->set_cell(Vector2i(x, y+i),layer,tile);
-                }
-            }
-            // Otherwise we insert a cellW x cellH tile
-            else {
-                setCell(pTileMap, layer, x, y, tile);
-            }
+            put_cell(pTileMap, layer, m_cave_info, mapW, mapH, x, y, map_tilename_to_vector2i(tile_name), false);
+        }
+    }
+}
+
+void GDCave::end_upload() {
+    monitors().tilesUploaded.store(m_tiles_set, std::memory_order_relaxed);
+    m_tiles_set = 0;
+}
+
+void GDCave::update_native_bytes() {
+    int64_t bytes = 0;
+    for (const auto& row : m_tile_map) {
+        bytes += row.size() * sizeof(int);
+    }
+    bytes += m_room_graph.mRooms.size() * sizeof(Cave::RoomInfo) +
+             m_room_graph.mEdges.size() * sizeof(Cave::RoomEdge) +
+             m_room_graph.mLabels.size() * sizeof(int);
+    for (int level = 0; level < getOverviewLevelCount(); ++level) {
+        bytes += m_overview->getLevel(level).mCoverage.size();
+    }
+    m_native_bytes.store(bytes, std::memory_order_relaxed);
+}
+
+// Erase the live chunks of the last streamed make_cave
+void GDCave::release_view() {
+    TileMapLayer* pTileMap = Object::cast_to<TileMapLayer>(ObjectDB::get_instance(m_view_tile_map_id));
+    if (pTileMap) {
+        for (int chunk : m_live_chunks) {
+            put_chunk(pTileMap, chunk, true);
+        }
+    }
+    m_live_chunks.clear();
+    m_chunk_live.clear();
+}
+
+void GDCave::put_chunk(TileMapLayer* pTileMap, int chunk, bool erase) {
+    const int x0 = (chunk % m_chunks_across) * m_chunk_cells;
+    const int y0 = (chunk / m_chunks_across) * m_chunk_cells;
+    const int x1 = std::min(x0 + m_chunk_cells, m_view_map_w);
+    const int y1 = std::min(y0 + m_chunk_cells, m_view_map_h);
+    for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x) {
+            // The tile doesn't matter for an erase (the map may be a rejected one)
+            Vector2i tile = erase ? Vector2i() : map_tilename_to_vector2i(static_cast<Cave::TileName>(m_tile_map[y][x]));
+            put_cell(pTileMap, m_view_layer, m_view_info, m_view_map_w, m_view_map_h, x, y, tile, erase);
         }
     }
 }
@@ -184,15 +1046,63 @@ Vector2i GDCave::map_tilename_to_vector2i(Cave::TileName tile_name) {
     }
 }
 
-void GDCave::setCell(TileMapLayer* pTileMap, int layer, int cx, int cy, Vector2i tile) {
-	int mapX = m_cave_info.mBorderWidth + (cx * m_cave_info.mCellWidth);
-    int mapY = m_cave_info.mBorderHeight + (cy * m_cave_info.mCellHeight);
-	for (int y=0; y < m_cave_info.mCellHeight; ++y) {
-		for (int x=0; x < m_cave_info.mCellWidth; ++x) {
-			Vector2i pos(mapX + x, mapY + y);
-            // For some reason Need to use -1,-1 for floor
-			Vector2 t = (tile.x < 0) ? tile : Vector2i(tile.x+x, tile.y+y);
-			pTileMap->set_cell(pos,layer,t);
-		}
-	}
+// Set (or erase) the TileMapLayer tiles of TileMap cell x,y
+void GDCave::put_cell(TileMapLayer* pTileMap, int layer, const Cave::CaveInfo& info, int mapW, int mapH, int x, int y, Vector2i tile, bool erase) {
+    for_each_tile(info, mapW, mapH, x, y, tile, [&](Vector2i pos, Vector2i t) {
+        if (erase) {
+            pTileMap->erase_cell(pos);
+        } else {
+            pTileMap->set_cell(pos, layer, t);
+            ++m_tiles_set;
+        }
+    });
+}
+
+//
+// The whole map as the layer's tile_map_data, so one call instead of a
+// set_cell per tile. It replaces everything in the layer. false (nothing
+// done) if the map is past the format's 16 bit coords.
+//
+bool GDCave::upload_batched(TileMapLayer* pTileMap, int layer) {
+    const int mapW = m_tile_map[0].size();
+    const int mapH = m_tile_map.size();
+    // uint16 format then per cell int16 x,y, uint16 source, atlas x,y and
+    // alternative, little endian
+    std::vector<uint8_t> bytes(2, 0);
+    bool fits = true;
+    int64_t cells = 0;
+    auto put16 = [&](int v) {
+        bytes.push_back(v & 0xFF);
+        bytes.push_back((v >> 8) & 0xFF);
+    };
+    for (int y = 0; y < mapH && fits; ++y) {
+        for (int x = 0; x < mapW; ++x) {
+            const Vector2i tile = map_tilename_to_vector2i(static_cast<Cave::TileName>(m_tile_map[y][x]));
+            for_each_tile(m_cave_info, mapW, mapH, x, y, tile, [&](Vector2i pos, Vector2i t) {
+                if (pos.x < INT16_MIN || pos.x > INT16_MAX || pos.y < INT16_MIN || pos.y > INT16_MAX) {
+                    fits = false;
+                }
+                // -1,-1 is no tile (set_cell erases), the layer starts empty
+                if (t.x < 0) {
+                    return;
+                }
+                put16(pos.x);
+                put16(pos.y);
+                put16(layer);
+                put16(t.x);
+                put16(t.y);
+                put16(0);
+                ++cells;
+            });
+        }
+    }
+    if (!fits) {
+        return false;
+    }
+    PackedByteArray data;
+    data.resize(bytes.size());
+    std::memcpy(data.ptrw(), bytes.data(), bytes.size());
+    pTileMap->set_tile_map_data_from_array(data);
+    m_tiles_set += cells;
+    return true;
 }
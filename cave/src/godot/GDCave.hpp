@@ -1,11 +1,27 @@
 #ifndef GD_CAVE_H
 #define GD_CAVE_H
 
+#include <godot_cpp/classes/image.hpp>
 #include <godot_cpp/classes/object.hpp>
+#include <godot_cpp/classes/static_body2d.hpp>
 #include <godot_cpp/classes/tile_map_layer.hpp>
+#include <godot_cpp/variant/dictionary.hpp>
+#include <godot_cpp/variant/packed_byte_array.hpp>
+#include <godot_cpp/variant/packed_int32_array.hpp>
+#include <godot_cpp/variant/packed_vector2_array.hpp>
+#include <godot_cpp/variant/rect2i.hpp>
+#include <cstdint>
+#include <atomic>
+#include <memory>
 #include <vector>
+#include "core/CaveCache.h"
 #include "core/CaveInfo.h"
+#include "core/DistanceField.h"
 #include "core/GenerationParams.h"
+#include "core/GenerationQueue.h"
+#include "core/GenerationStats.h"
+#include "core/OverviewMap.h"
+#include "core/RoomGraph.h"
 #include "core/TileTypes.h"
 
 namespace godot {
@@ -19,6 +35,38 @@ protected:
 	Cave::CaveInfo m_cave_info;
     Cave::GenerationParams m_gen_params;
 	std::vector<std::vector<int>> m_tile_map;
+	bool m_build_room_graph = false;
+	Cave::RoomGraph m_room_graph;
+	Cave::GenerationStats m_stats;
+	std::unique_ptr<Cave::DistanceField> m_distance_field;
+	int m_overview_levels = 0;
+	int m_overview_threshold = -1;
+	std::unique_ptr<Cave::OverviewMap> m_overview;
+	std::unique_ptr<Cave::CaveCache> m_cache;
+	std::unique_ptr<Cave::GenerationQueue> m_queue;
+	Cave::CancelToken m_cancel;
+	// While this is a layer of a make_cave_layers running on another GDCave,
+	// that one's m_cancel, so cancel() reaches it
+	std::atomic<Cave::CancelToken*> m_layers_cancel{nullptr};
+	// For the monitors: tiles set by the current copy/update_view, and the
+	// map, room graph and overview held
+	int64_t m_tiles_set = 0;
+	std::atomic<int64_t> m_native_bytes{0};
+
+	// View streaming: make_cave only keeps the map and update_view puts
+	// the chunks round the view into the TileMapLayer
+	bool m_view_streaming = false;
+	int m_chunk_cells = 16;
+	int m_chunk_margin = 1;
+	uint64_t m_view_tile_map_id = 0;
+	int m_view_layer = 0;
+	bool m_view_current = false;        // false after a rejected make_cave
+	Cave::CaveInfo m_view_info;         // layout the live chunks were put with
+	int m_view_map_w = 0;
+	int m_view_map_h = 0;
+	int m_chunks_across = 0;
+	std::vector<uint8_t> m_chunk_live;
+	std::vector<int> m_live_chunks;
 
     godot::Vector2i m_floor_tile;
     godot::Vector2i m_wall_tile;
@@ -28,6 +76,10 @@ public:
 	GDCave();
 	~GDCave();
 
+	// "GDCave/..." Performance monitors, summed over every GDCave
+	static void add_monitors();
+	static void remove_monitors();
+
 	GDCave* setCaveSize(Vector2i caveSize);
 	GDCave* setBorderCellSize(Vector2i border);
 	GDCave* setCellSize(Vector2i cellSize);
@@ -40,13 +92,95 @@ public:
 	GDCave* setFreq(float freq);
 	GDCave* setAmp(float amp);
 	GDCave* setGenerations(const godot::Array& gens);
+	GDCave* setPyramid(int scale, const godot::Array& refineGens);
+	GDCave* setDetectOscillation(bool detect);
+	GDCave* setMinRoomSize(int cells);
+	GDCave* setThreads(int threads);
+	GDCave* setAcceptance(float minFloorRatio, float maxFloorRatio, int minRooms, int maxRooms, int maxTunnels);
+	GDCave* setRoomGraph(bool buildRoomGraph);
+	GDCave* setOverview(int levels, int threshold);
+	GDCave* setViewStreaming(bool enabled, int chunkCells, int margin);
+	GDCave* setCache(int64_t maxBytes, const String& directory);
+	GDCave* setPregeneration(int workers, int64_t maxBytes);
+
+	// false if the cave failed the acceptance criteria (nothing is copied)
+	bool make_cave(TileMapLayer* pTileMap, int layer, int seed);
+	// A layer per GDCave in caves (each with its own settings, all the same
+	// cave size) for seed, sharing the noise and CA steps they have in
+	// common, then each is put in the TileMapLayer at the same index in
+	// tileMaps. cancel() on any of the caves stops it. As with make_cave, a
+	// layer in its GDCave's cache or
+	// pregeneration queue is taken from there, and the generated ones go in
+	// its cache. Each layer's map, room graph and stats are what make_cave
+	// would have given it, with the shared noise and CA time in the
+	// stage_ms of every layer that shared it; the stage monitors have the
+	// time spent over all the layers, each shared step once.
+	// false if any layer was rejected (that one's TileMapLayer is left alone).
+	bool make_cave_layers(const godot::Array& caves, const godot::Array& tileMaps, int layer, int seed);
+	Dictionary getGenerationStats() const;
+	Dictionary getCacheStats() const;
+	void clearCache();
+
+	// Queue a make_cave with the current settings and this seed to be
+	// generated in the background (higher priority first)
+	bool pregenerate(int seed, int priority);
+	Dictionary getPregenerationStats() const;
+	// Stop a make_cave, or a make_cave_layers this is one of the caves of,
+	// running on another thread (it returns false with rejection CANCELLED)
+	// and drop/stop the pregeneration jobs
+	void cancel();
+
+	// Chrome trace of the generation stages (see core/Trace.h). The trace
+	// is shared by every GDCave.
+	void setTracing(bool enabled);
+	bool dumpTrace(const String& path);
+
+	// With set_view_streaming: put the chunks round rect (TileMapLayer
+	// coords) in the layer and erase the rest. Returns the chunks changed.
+	int update_view(Rect2i rect);
+	int getLiveChunkCount() const;
+
+	// Room graph of the last make_cave (empty unless set_room_graph(true))
+	// - ids are the index into the per room arrays
+	PackedInt32Array getRoomCellCounts() const;
+	PackedInt32Array getRoomBounds() const;
+	PackedVector2Array getRoomCentroids() const;
+	PackedInt32Array getRoomEdges() const;
+	PackedInt32Array getRoomLabels() const;
+
+	// Distance fields over the floor of the last make_cave
+	// - distances are in DistanceField units (3 = 1 cell), -1 = unreachable
+	PackedInt32Array computeDistanceField(const godot::Array& sources);
+	PackedInt32Array updateDistanceSources(const godot::Array& sources);
+	PackedByteArray getFlowField() const;
+	PackedInt32Array getWallDistances() const;
+
+	// Overview of the last make_cave (level 0 = 2x down, 1 = 4x ...)
+	int getOverviewLevelCount() const;
+	PackedByteArray getOverview(int level) const;
+	Ref<Image> getOverviewImage(int level) const;
 
-	void make_cave(TileMapLayer* pTileMap, int layer, int seed);
+	// Replace the shapes of pBody with merged collision for the last
+	// make_cave. pBody should share pTileMap's transform.
+	int build_collision(TileMapLayer* pTileMap, StaticBody2D* pBody);
 
 private:
     void copy_core_to_tilemap(TileMapLayer* pTileMap, int layer, const Cave::TileMap& caveMap);
     Vector2i map_tilename_to_vector2i(Cave::TileName tile_name);
-    void setCell(TileMapLayer* pTileMap, int layer, int x, int y, Vector2i tile);
+    static std::vector<Cave::GenerationStep> to_steps(const godot::Array& gens);
+    static std::vector<Cave::Vector2i> to_cave_points(const godot::Array& points);
+    static PackedInt32Array to_packed(const std::vector<int>& values);
+    void put_cell(TileMapLayer* pTileMap, int layer, const Cave::CaveInfo& info, int mapW, int mapH, int x, int y, Vector2i tile, bool erase);
+    void put_chunk(TileMapLayer* pTileMap, int chunk, bool erase);
+    bool upload_batched(TileMapLayer* pTileMap, int layer);
+    void release_view();
+    void end_upload();
+    void update_native_bytes();
+    static double monitor_stage_ms(int stage);
+    static int64_t monitor_tiles_uploaded();
+    static int64_t monitor_cache(bool hits);
+    static int64_t monitor_jobs(bool running);
+    static int64_t monitor_native_bytes();
 };
 
 }
@@ -10,6 +10,10 @@
 using namespace godot;
 
 void initialize_libgdcave(ModuleInitializationLevel p_level) {
+	if (p_level == MODULE_INITIALIZATION_LEVEL_SCENE) {
+		GDCave::add_monitors();
+		return;
+	}
 	if (p_level != MODULE_INITIALIZATION_LEVEL_CORE) {
 		return;
 	}
@@ -22,6 +26,7 @@ void uninitialize_libgdcave(ModuleInitializationLevel p_level) {
 	if (p_level != MODULE_INITIALIZATION_LEVEL_SCENE) {
 		return;
 	}
+	GDCave::remove_monitors();
 }
 
 extern "C" {
@@ -0,0 +1,372 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "core/Cave.h"
+#include "core/CaveInfo.h"
+#include "core/CaveStreamer.h"
+#include "core/GenerationParams.h"
+#include "core/Parallel.h"
+#include "core/RowSink.h"
+#include "core/TileTypes.h"
+
+//
+// Bakes a range of seeds of a preset offline.
+//   cave_bake <preset> <first seed> <count> <out dir> [options]
+//     --format cave|pgm   cave (default) is FileRowSink's int32 w,h then a
+//                         byte (TileName) per tile, pgm a greyscale image
+//                         with floor white, walls black and the smoothed
+//                         wall shapes grey
+//     --workers N         seeds generated at once (default all cores)
+//     --band N            stream each cave N rows at a time (CaveStreamer)
+//                         for maps too big to hold, no pyramid
+//
+// Each accepted cave is written to <out dir>/<seed>.<format> and every seed
+// gets a line in <out dir>/stats.csv (written in seed order at the end).
+//
+// The preset is the README setup and generations as text, one per line
+// ('#' starts a comment):
+//   size 512 512
+//   border 8 8
+//   cell 8 8
+//   octaves 1
+//   freq 13.7
+//   amp 1
+//   perlin 0
+//   wall_chance 0.5
+//   gen_3x3 5 8 4 8 6
+//   gen_3x3_5x5 5 9 15 25 3 8 15 20 4
+//   gen 0 9 0 25 0 9 0 25 4 4 45 81 39 81   (as set_generations)
+//   min_room_size 6
+//   pyramid 4
+//   refine_3x3 / refine_3x3_5x5 / refine   (as the gen lines, for pyramid)
+//   accept 0.35 0.6 5 40 -1   (floor min max, rooms min max, max tunnels)
+//
+namespace {
+
+struct Preset {
+    Cave::CaveInfo info;
+    Cave::GenerationParams params;
+};
+
+// The ints after the keyword, false if there is anything else
+bool readInts(std::istringstream& in, std::vector<int>& values) {
+    values.clear();
+    int v;
+    while (in >> v) {
+        values.push_back(v);
+    }
+    return in.eof();
+}
+
+bool readInts(std::istringstream& in, size_t count, std::vector<int>& values) {
+    return readInts(in, values) && values.size() == count;
+}
+
+// gen_3x3, gen_3x3_5x5 or gen (the set_generations layout, 9 values or 14
+// with a radius)
+bool readStep(const std::string& kind, std::istringstream& in, Cave::GenerationStep& step) {
+    std::vector<int> v;
+    if (!readInts(in, v)) {
+        return false;
+    }
+    if (kind == "3x3" && v.size() == 5) {
+        step = {v[0], v[1], 0, 25, v[2], v[3], 0, 25, v[4]};
+        return true;
+    }
+    if ((kind == "3x3_5x5" && v.size() == 9) || (kind.empty() && v.size() == 9)) {
+        step = {v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8]};
+        return true;
+    }
+    if (kind.empty() && v.size() == 14) {
+        step = {v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8],
+                v[9], v[10], v[11], v[12], v[13]};
+        return true;
+    }
+    return false;
+}
+
+bool loadPreset(const std::string& path, Preset& preset) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << path << ": can't open" << std::endl;
+        return false;
+    }
+    Cave::CaveInfo& info = preset.info;
+    Cave::GenerationParams& params = preset.params;
+    params.mOctaves = 1;
+    std::string line;
+    int lineNo = 0;
+    while (std::getline(file, line)) {
+        ++lineNo;
+        line = line.substr(0, line.find('#'));
+        std::istringstream in(line);
+        std::string keyword;
+        if (!(in >> keyword)) {
+            continue;
+        }
+        std::vector<int> v;
+        bool ok = true;
+        if (keyword == "size") {
+            ok = readInts(in, 2, v);
+            if (ok) {
+                info.mCaveWidth = v[0];
+                info.mCaveHeight = v[1];
+            }
+        } else if (keyword == "border") {
+            ok = readInts(in, 2, v);
+            if (ok) {
+                info.mBorderWidth = v[0];
+                info.mBorderHeight = v[1];
+            }
+        } else if (keyword == "cell") {
+            ok = readInts(in, 2, v);
+            if (ok) {
+                info.mCellWidth = v[0];
+                info.mCellHeight = v[1];
+            }
+        } else if (keyword == "octaves") {
+            ok = readInts(in, 1, v);
+            if (ok) {
+                params.mOctaves = v[0];
+            }
+        } else if (keyword == "perlin") {
+            ok = readInts(in, 1, v);
+            if (ok) {
+                params.mPerlin = v[0] != 0;
+            }
+        } else if (keyword == "min_room_size") {
+            ok = readInts(in, 1, v);
+            if (ok) {
+                params.mMinRoomSize = v[0];
+            }
+        } else if (keyword == "pyramid") {
+            ok = readInts(in, 1, v);
+            if (ok) {
+                params.mPyramidScale = v[0];
+            }
+        } else if (keyword == "freq") {
+            ok = static_cast<bool>(in >> params.mFreq);
+        } else if (keyword == "amp") {
+            ok = static_cast<bool>(in >> params.mAmp);
+        } else if (keyword == "wall_chance") {
+            ok = static_cast<bool>(in >> params.mWallChance);
+        } else if (keyword == "accept") {
+            Cave::AcceptanceCriteria& accept = params.mAccept;
+            ok = static_cast<bool>(in >> accept.mMinFloorRatio >> accept.mMaxFloorRatio >>
+                                   accept.mMinRooms >> accept.mMaxRooms >> accept.mMaxTunnels);
+        } else if (keyword.compare(0, 4, "gen_") == 0 || keyword == "gen") {
+            Cave::GenerationStep step;
+            ok = readStep(keyword == "gen" ? "" : keyword.substr(4), in, step);
+            if (ok) {
+                params.mGenerations.push_back(step);
+            }
+        } else if (keyword.compare(0, 7, "refine_") == 0 || keyword == "refine") {
+            Cave::GenerationStep step;
+            ok = readStep(keyword == "refine" ? "" : keyword.substr(7), in, step);
+            if (ok) {
+                params.mRefineGenerations.push_back(step);
+            }
+        } else {
+            std::cerr << path << ":" << lineNo << ": unknown '" << keyword << "'" << std::endl;
+            return false;
+        }
+        if (!ok) {
+            std::cerr << path << ":" << lineNo << ": bad values for '" << keyword << "'" << std::endl;
+            return false;
+        }
+    }
+    if (info.mCaveWidth < 2 || info.mCaveHeight < 2 || params.mGenerations.empty()) {
+        std::cerr << path << ": needs a size and at least one generation" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+//
+// Binary greyscale PGM, a pixel per tile
+//
+class PgmRowSink : public Cave::RowSink {
+public:
+    explicit PgmRowSink(const std::string& path) : mPath(path) {}
+    ~PgmRowSink() { end(); }
+
+    bool isOk() const { return mOk; }
+
+    void begin(int width, int height) override {
+        mFile = std::fopen(mPath.c_str(), "wb");
+        mOk = mFile && std::fprintf(mFile, "P5\n%d %d\n255\n", width, height) > 0;
+    }
+
+    void writeRow(int /*y*/, const std::vector<int>& row) override {
+        if (!mFile || !mOk) {
+            return;
+        }
+        mBytes.resize(row.size());
+        for (size_t x = 0; x < row.size(); ++x) {
+            mBytes[x] = (row[x] == Cave::FLOOR) ? 255 : (row[x] == Cave::WALL) ? 0 : 128;
+        }
+        mOk = std::fwrite(mBytes.data(), 1, mBytes.size(), mFile) == mBytes.size();
+    }
+
+    void end() override {
+        if (mFile) {
+            mOk = (std::fclose(mFile) == 0) && mOk;
+            mFile = nullptr;
+        }
+    }
+
+private:
+    std::string mPath;
+    FILE* mFile = nullptr;
+    bool mOk = false;
+    std::vector<unsigned char> mBytes;
+};
+
+struct Result {
+    Cave::GenerationStats stats;
+    double ms = 0;
+    bool written = false;
+};
+
+// Generate one seed and write it if accepted
+void bake(const Preset& preset, int seed, int bandRows, bool pgm,
+          const std::string& outDir, Result& result) {
+    Cave::CaveInfo info = preset.info;
+    Cave::GenerationParams params = preset.params;
+    params.seed = seed;
+    // The seeds are the parallelism
+    params.mThreads = 1;
+
+    const std::string path = outDir + "/" + std::to_string(seed) + (pgm ? ".pgm" : ".cave");
+    std::unique_ptr<Cave::RowSink> sink;
+    if (pgm) {
+        sink = std::make_unique<PgmRowSink>(path);
+    } else {
+        sink = std::make_unique<Cave::FileRowSink>(path);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    bool accepted;
+    if (bandRows > 0) {
+        Cave::CaveStreamer streamer(info, params, bandRows);
+        accepted = streamer.generate(*sink);
+        result.stats = streamer.getStats();
+    } else {
+        Cave::Cave cave(info, params);
+        Cave::TileMap tileMap = cave.generate();
+        result.stats = cave.getStats();
+        accepted = result.stats.mRejection == Cave::ACCEPTED;
+        if (accepted) {
+            sink->begin(tileMap[0].size(), tileMap.size());
+            for (size_t y = 0; y < tileMap.size(); ++y) {
+                sink->writeRow(y, tileMap[y]);
+            }
+        }
+    }
+    sink->end();
+    result.ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    result.written = accepted && (pgm ? static_cast<PgmRowSink&>(*sink).isOk()
+                                      : static_cast<Cave::FileRowSink&>(*sink).isOk());
+    if (accepted && !result.written) {
+        std::cerr << path << ": write failed" << std::endl;
+    }
+}
+
+int usage() {
+    std::cerr << "cave_bake <preset> <first seed> <count> <out dir>"
+                 " [--format cave|pgm] [--workers N] [--band N]" << std::endl;
+    return 2;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 5) {
+        return usage();
+    }
+    const std::string presetPath = argv[1];
+    const int firstSeed = std::atoi(argv[2]);
+    const int count = std::atoi(argv[3]);
+    const std::string outDir = argv[4];
+    bool pgm = false;
+    int workers = 0;
+    int bandRows = 0;
+    for (int i = 5; i < argc; ++i) {
+        const std::string option = argv[i];
+        if (i + 1 >= argc) {
+            return usage();
+        }
+        const std::string value = argv[++i];
+        if (option == "--format" && (value == "cave" || value == "pgm")) {
+            pgm = value == "pgm";
+        } else if (option == "--workers") {
+            workers = std::atoi(value.c_str());
+        } else if (option == "--band") {
+            bandRows = std::atoi(value.c_str());
+        } else {
+            return usage();
+        }
+    }
+
+    Preset preset;
+    if (!loadPreset(presetPath, preset)) {
+        return 1;
+    }
+    if (bandRows > 0 && preset.params.mPyramidScale > 1) {
+        std::cerr << presetPath << ": --band can't be used with a pyramid" << std::endl;
+        return 1;
+    }
+    std::error_code error;
+    std::filesystem::create_directories(outDir, error);
+    if (error) {
+        std::cerr << outDir << ": " << error.message() << std::endl;
+        return 1;
+    }
+    if (bandRows > 0 && preset.params.mPyramidScale > 1) {
+        std::cerr << "--band doesn't support pyramid" << std::endl;
+        return 1;
+    }
+
+    std::vector<Result> results(std::max(count, 0));
+    std::atomic<int> next{0};
+    std::mutex logMutex;
+    const int threads = std::min(Cave::resolveThreads(workers), std::max(count, 1));
+    Cave::parallelFor(threads, [&](int) {
+        for (int i = next++; i < count; i = next++) {
+            bake(preset, firstSeed + i, bandRows, pgm, outDir, results[i]);
+            std::lock_guard<std::mutex> lock(logMutex);
+            std::cout << "seed " << (firstSeed + i) << " rejection "
+                      << results[i].stats.mRejection << " " << results[i].ms << "ms" << std::endl;
+        }
+    });
+
+    std::ofstream stats(outDir + "/stats.csv");
+    stats << "seed,rejection,floor_ratio,rooms,tunnels,ms,file" << std::endl;
+    int written = 0;
+    for (int i = 0; i < count; ++i) {
+        const Result& r = results[i];
+        stats << (firstSeed + i) << "," << r.stats.mRejection << "," << r.stats.mFloorRatio
+              << "," << r.stats.mRoomCount << "," << r.stats.mTunnelCount << "," << r.ms << ","
+              << (r.written ? std::to_string(firstSeed + i) + (pgm ? ".pgm" : ".cave") : "")
+              << std::endl;
+        written += r.written;
+    }
+    if (!stats) {
+        std::cerr << outDir << "/stats.csv: write failed" << std::endl;
+        return 1;
+    }
+    std::cout << written << " of " << count << " written to " << outDir << std::endl;
+    return 0;
+}
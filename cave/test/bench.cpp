@@ -0,0 +1,386 @@
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "core/Cave.h"
+#include "core/CaveStreamer.h"
+#include "core/CellularAutomata.h"
+#include "core/CaveInfo.h"
+#include "core/GenerationParams.h"
+#include "core/NoiseKernel.h"
+#include "core/RowSink.h"
+#include "RogueCave.hpp"
+
+//
+// Times generate() for the README presets at full resolution against the
+// coarse to fine pyramid. "ca" is just the noise and CA (the cave is
+// rejected on the floor ratio straight after) and "all" the whole thing.
+//   cave_bench [size...]   (default 1024 2048 4096)
+//
+// Or the CA on its own, row major against TILED, for widths 256 .. 8192
+// (x 512 rows) for a few of the presets.
+//   cave_bench layout
+//
+// Or check that stopping a step early (no change, or repeating every 2 reps)
+// gives the same cells as running every rep, and that the presets give the
+// same cells as PCG::RogueCave, for each layout and a few seeds. Then that
+// the CaveStreamer makes the same map as generate() for each preset at a
+// spread of sizes, seeds and band heights. Exits with 1 if any differ.
+//   cave_bench check
+//
+// Or the perlin fill through the NoiseKernel against Algo::getSNoise2 a cell
+// at a time, for 1 .. 8 octaves on a 2048 square at mFreq 13.7 and 1000:
+// whether the kernel is used, how many cells went to the library anyway
+// (near the threshold, or all of them if it isn't used), and any that came
+// out different. Exits with 1 if any did.
+//   cave_bench noise
+//
+namespace {
+
+struct Preset {
+    const char* name;
+    float wallChance;
+    std::vector<Cave::GenerationStep> steps;
+};
+
+// add_gen_3x3(b3_min,b3_max, s3_min,s3_max, reps)
+Cave::GenerationStep gen3x3(int b3Min, int b3Max, int s3Min, int s3Max, int reps) {
+    return {b3Min, b3Max, 0, 25, s3Min, s3Max, 0, 25, reps};
+}
+
+// add_gen_3x3_5x5(b3_min,b3_max, b5_min,b5_max, s3_min,s3_max, s5_min,s5_max, reps)
+Cave::GenerationStep gen3x3_5x5(int b3Min, int b3Max, int b5Min, int b5Max,
+                                int s3Min, int s3Max, int s5Min, int s5Max, int reps) {
+    return {b3Min, b3Max, b5Min, b5Max, s3Min, s3Max, s5Min, s5Max, reps};
+}
+
+const std::vector<Preset> presets = {
+    {"1. Organic & Open", 0.50f,
+     {gen3x3(5,8, 4,8, 6), gen3x3(6,8, 3,8, 6), gen3x3(4,4, 4,8, 5)}},
+    {"2. Balanced", 0.40f, {gen3x3(4,5, 4,7, 4), gen3x3(3,8, 1,8, 1)}},
+    {"3. Sparse Maze", 0.20f, {gen3x3(3,3, 1,5, 10)}},
+    {"4. Connected Maze", 0.40f, {gen3x3(3,3, 2,4, 10)}},
+    {"5. Open Maze", 0.35f, {gen3x3(3,3, 2,4, 6)}},
+    {"6. Curvy (5x5)", 0.40f, {gen3x3_5x5(5,9, 15,25, 3,8, 15,20, 4)}},
+    {"7. Swiss Cheese", 0.65f, {gen3x3_5x5(3,4, 12,16, 2,5, 10,14, 2)}},
+    {"8. Broken Walls", 0.40f, {gen3x3_5x5(4,5, 13,17, 4,5, 14,20, 4)}},
+};
+
+double timeGenerate(const Preset& preset, int size, int scale, bool caOnly,
+                    float& floorRatio) {
+    Cave::CaveInfo info;
+    info.mCaveWidth = size;
+    info.mCaveHeight = size;
+
+    Cave::GenerationParams params;
+    params.seed = 424242;
+    params.mOctaves = 1;
+    params.mFreq = 13.7f;
+    params.mWallChance = preset.wallChance;
+    params.mGenerations = preset.steps;
+    params.mPyramidScale = scale;
+    if (caOnly) {
+        params.mAccept.mMaxFloorRatio = -1;
+    }
+
+    Cave::Cave cave(info, params);
+    auto start = std::chrono::steady_clock::now();
+    cave.generate();
+    auto end = std::chrono::steady_clock::now();
+    floorRatio = cave.getStats().mFloorRatio;
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void randomFill(Cave::CellularAutomata& ca, int width, int height, float wallChance,
+                unsigned rng) {
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            rng = rng * 1103515245u + 12345u;
+            ca.setWall(x, y, (rng >> 16) % 1000 < wallChance * 1000);
+        }
+    }
+}
+
+double timeCA(const Preset& preset, int width, int height, Cave::GridLayout layout) {
+    Cave::CellularAutomata ca(width, height, layout);
+    randomFill(ca, width, height, preset.wallChance, 424242);
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& step : preset.steps) {
+        // Every rep so both layouts do the same work
+        ca.runStep(step, false);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void benchLayouts() {
+    const int height = 512;
+    std::cout << std::left << std::setw(20) << "preset" << std::setw(7) << "width"
+              << std::right << std::setw(10) << "rows ms" << std::setw(10) << "tiled ms"
+              << std::setw(8) << "ratio" << std::endl;
+    for (int p : {0, 3, 5}) {
+        const Preset& preset = presets[p];
+        for (int width = 256; width <= 8192; width *= 2) {
+            double rows = timeCA(preset, width, height, Cave::ROW_MAJOR);
+            double tiled = timeCA(preset, width, height, Cave::TILED);
+            std::cout << std::left << std::setw(20) << preset.name << std::setw(7) << width
+                      << std::right << std::fixed << std::setprecision(1)
+                      << std::setw(10) << rows << std::setw(10) << tiled
+                      << std::setprecision(2) << std::setw(8) << (rows / tiled) << std::endl;
+        }
+    }
+}
+
+bool checkEarlyExit() {
+    const int width = 97;
+    const int height = 61;
+    std::vector<Preset> checks = presets;
+    // A step with a radius, ones that settle, and ones that end up
+    // repeating every 2 reps with an odd and an even number of reps left
+    checks.push_back({"9. Radius 4", 0.45f, {{0,9, 0,25, 0,9, 0,25, 4, 4, 45,81, 39,81}}});
+    checks.push_back({"Remove singles", 0.50f, {gen3x3(9,9, 2,9, 8)}});
+    checks.push_back({"Organic (long)", 0.50f, {gen3x3(5,8, 4,8, 40)}});
+    checks.push_back({"Invert (odd)", 0.50f, {gen3x3(0,9, 10,10, 7)}});
+    checks.push_back({"Invert (even)", 0.50f, {gen3x3(0,9, 10,10, 8)}});
+    checks.push_back({"Life (odd)", 0.30f, {gen3x3(3,3, 3,4, 2001)}});
+    checks.push_back({"Life (even)", 0.30f, {gen3x3(3,3, 3,4, 2000)}});
+    int failures = 0;
+    int converged = 0;
+    int oscillating = 0;
+    for (const Preset& preset : checks) {
+        for (Cave::GridLayout layout : {Cave::ROW_MAJOR, Cave::TILED}) {
+            for (unsigned seed = 1; seed <= 8; ++seed) {
+                Cave::CellularAutomata stopped(width, height, layout);
+                Cave::CellularAutomata full(width, height, layout);
+                randomFill(stopped, width, height, preset.wallChance, seed);
+                randomFill(full, width, height, preset.wallChance, seed);
+                for (const auto& step : preset.steps) {
+                    const Cave::StepStats stats = stopped.runStep(step, true);
+                    converged += stats.mConverged;
+                    oscillating += stats.mOscillating;
+                    for (int rep = 0; rep < step.reps; ++rep) {
+                        full.runRep(step);
+                    }
+                }
+                bool same = true;
+                for (int y = 0; y < height && same; ++y) {
+                    for (int x = 0; x < width && same; ++x) {
+                        same = stopped.isWall(x, y) == full.isWall(x, y);
+                    }
+                }
+                if (!same) {
+                    std::cout << "DIFFERENT: " << preset.name << " layout " << layout
+                              << " seed " << seed << std::endl;
+                    ++failures;
+                }
+            }
+        }
+    }
+    std::cout << "early exit check: " << failures << " different, " << converged
+              << " steps converged, " << oscillating << " repeating" << std::endl;
+    return failures == 0;
+}
+
+// The README presets through CellularAutomata against PCG::RogueCave, the
+// rule it replaced (3x3 and 5x5 steps only, it has no radius)
+bool checkRogueCave() {
+    const int width = 97;
+    const int height = 61;
+    int failures = 0;
+    for (const Preset& preset : presets) {
+        for (Cave::GridLayout layout : {Cave::ROW_MAJOR, Cave::TILED}) {
+            for (unsigned seed = 1; seed <= 4; ++seed) {
+                Cave::CellularAutomata ca(width, height, layout);
+                randomFill(ca, width, height, preset.wallChance, seed);
+                PCG::RogueCave rogue(width, height);
+                std::vector<std::vector<int>>& gridIn = rogue.getGrid();
+                for (int y = 0; y < height; ++y) {
+                    for (int x = 0; x < width; ++x) {
+                        gridIn[y][x] = ca.isWall(x, y) ? PCG::RogueCave::TILE_WALL
+                                                       : PCG::RogueCave::TILE_FLOOR;
+                    }
+                }
+                for (const auto& step : preset.steps) {
+                    ca.runStep(step, true);
+                    rogue.addGeneration(Util::IntRange(step.b3_min, step.b3_max),
+                                        Util::IntRange(step.b5_min, step.b5_max),
+                                        Util::IntRange(step.s3_min, step.s3_max),
+                                        Util::IntRange(step.s5_min, step.s5_max), step.reps);
+                }
+                std::vector<std::vector<int>>& gridOut = rogue.generate();
+                int different = 0;
+                for (int y = 0; y < height; ++y) {
+                    for (int x = 0; x < width; ++x) {
+                        different += ca.isWall(x, y) !=
+                                     (gridOut[y][x] == PCG::RogueCave::TILE_WALL);
+                    }
+                }
+                if (different) {
+                    std::cout << "DIFFERENT FROM ROGUECAVE: " << preset.name << " layout "
+                              << layout << " seed " << seed << " cells " << different
+                              << std::endl;
+                    ++failures;
+                }
+            }
+        }
+    }
+    std::cout << "RogueCave check: " << failures << " different" << std::endl;
+    return failures == 0;
+}
+
+bool checkStreamer() {
+    int failures = 0;
+    int accepted = 0;
+    unsigned rng = 424242;
+    for (const Preset& preset : presets) {
+        for (int run = 0; run < 8; ++run) {
+            rng = rng * 1103515245u + 12345u;
+            Cave::CaveInfo info;
+            info.mCaveWidth = 40 + (rng >> 16) % 300;
+            rng = rng * 1103515245u + 12345u;
+            info.mCaveHeight = 40 + (rng >> 16) % 300;
+            Cave::GenerationParams params;
+            params.seed = (int)(rng >> 8);
+            params.mOctaves = 1;
+            params.mFreq = 13.7f;
+            params.mWallChance = preset.wallChance;
+            params.mGenerations = preset.steps;
+            params.mMinRoomSize = (run % 2) ? 8 : 0;
+
+            Cave::Cave cave(info, params);
+            Cave::TileMap whole = cave.generate();
+            Cave::CaveStreamer streamer(info, params, 16 + 24 * (run % 4));
+            Cave::TileMapSink sink;
+            const bool ok = streamer.generate(sink);
+            const bool wholeOk = cave.getStats().mRejection == Cave::ACCEPTED;
+            int different = 0;
+            if (ok && wholeOk) {
+                ++accepted;
+                const Cave::TileMap& streamed = sink.getTileMap();
+                for (size_t y = 0; y < whole.size(); ++y) {
+                    for (size_t x = 0; x < whole[y].size(); ++x) {
+                        different += whole[y][x] != streamed[y][x];
+                    }
+                }
+            }
+            if (ok != wholeOk || different) {
+                std::cout << "STREAMED DIFFERENT: " << preset.name << " "
+                          << info.mCaveWidth << "x" << info.mCaveHeight << " seed "
+                          << params.seed << " tiles " << different << std::endl;
+                ++failures;
+            }
+        }
+    }
+    std::cout << "streamer check: " << failures << " different, " << accepted
+              << " maps compared" << std::endl;
+    return failures == 0;
+}
+
+// Returns the cells that came out different from the library
+long benchNoiseAt(double freq, int octaves) {
+    const int size = 2048;
+    // As Cave::noiseRow with mAmp 1
+    std::vector<double> xs(size);
+    for (int x = 0; x < size; ++x) {
+        xs[x] = x / (double)size * freq;
+    }
+    std::vector<uint8_t> kernelWalls(size);
+    std::vector<uint8_t> libraryWalls(size);
+    const bool used = Cave::NoiseKernel::matchesLibrary(octaves, freq);
+    double libraryMs = 0;
+    double kernelMs = 0;
+    long resolved = 0;
+    long different = 0;
+    for (int y = 0; y < size; ++y) {
+        const double ny = y / (double)size * freq;
+        auto start = std::chrono::steady_clock::now();
+        Cave::NoiseKernel::fillWallsLibrary(xs.data(), ny, size, octaves,
+                                            libraryWalls.data());
+        auto mid = std::chrono::steady_clock::now();
+        resolved += Cave::NoiseKernel::fillWalls(xs.data(), ny, size, octaves,
+                                                 kernelWalls.data());
+        auto end = std::chrono::steady_clock::now();
+        libraryMs += std::chrono::duration<double, std::milli>(mid - start).count();
+        kernelMs += std::chrono::duration<double, std::milli>(end - mid).count();
+        for (int x = 0; x < size; ++x) {
+            different += kernelWalls[x] != libraryWalls[x];
+        }
+    }
+    std::cout << std::left << std::fixed << std::setprecision(1) << std::setw(8) << freq
+              << std::setw(8) << octaves << std::right
+              << std::scientific << std::setprecision(2) << std::setw(12)
+              << Cave::NoiseKernel::maxLibraryError(octaves, freq) << std::setw(8)
+              << (used ? "yes" : "no") << std::fixed << std::setprecision(1)
+              << std::setw(12) << libraryMs << std::setw(12) << kernelMs
+              << std::setprecision(3) << std::setw(9)
+              << 100.0 * resolved / ((double)size * size) << "%" << std::setw(8)
+              << different << std::endl;
+    return different;
+}
+
+bool benchNoise() {
+    std::cout << "isa: " << Cave::NoiseKernel::getIsaName() << std::endl;
+    std::cout << std::left << std::setw(8) << "freq" << std::setw(8) << "octaves"
+              << std::right << std::setw(12) << "max error" << std::setw(8) << "used"
+              << std::setw(12) << "library ms" << std::setw(12) << "kernel ms"
+              << std::setw(10) << "resolved" << std::setw(8) << "diff" << std::endl;
+    long failures = 0;
+    for (double freq : {13.7, 1000.0}) {
+        for (int octaves = 1; octaves <= 8; ++octaves) {
+            failures += benchNoiseAt(freq, octaves);
+        }
+    }
+    return failures == 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string(argv[1]) == "layout") {
+        benchLayouts();
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "check") {
+        const bool earlyExit = checkEarlyExit();
+        const bool rogueCave = checkRogueCave();
+        const bool streamer = checkStreamer();
+        return (earlyExit && rogueCave && streamer) ? 0 : 1;
+    }
+    if (argc > 1 && std::string(argv[1]) == "noise") {
+        return benchNoise() ? 0 : 1;
+    }
+    std::vector<int> sizes;
+    for (int i = 1; i < argc; ++i) {
+        sizes.push_back(std::atoi(argv[i]));
+    }
+    if (sizes.empty()) {
+        sizes = {1024, 2048, 4096};
+    }
+    const int scales[] = {1, 2, 4};
+
+    std::cout << std::left << std::setw(20) << "preset" << std::setw(7) << "size";
+    for (int scale : scales) {
+        const std::string x = "x" + std::to_string(scale);
+        std::cout << std::right << std::setw(10) << (x + " ca") << std::setw(10)
+                  << (x + " all") << std::setw(8) << "floor";
+    }
+    std::cout << std::endl;
+
+    for (int size : sizes) {
+        for (const Preset& preset : presets) {
+            std::cout << std::left << std::setw(20) << preset.name << std::setw(7) << size;
+            for (int scale : scales) {
+                float floorRatio = 0;
+                double caMs = timeGenerate(preset, size, scale, true, floorRatio);
+                double allMs = timeGenerate(preset, size, scale, false, floorRatio);
+                std::cout << std::right << std::fixed << std::setprecision(1)
+                          << std::setw(10) << caMs << std::setw(10) << allMs
+                          << std::setprecision(2) << std::setw(8) << floorRatio;
+            }
+            std::cout << std::endl;
+        }
+    }
+    return 0;
+}
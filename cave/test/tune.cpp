@@ -0,0 +1,499 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "core/Cave.h"
+#include "core/CaveInfo.h"
+#include "core/DistanceField.h"
+#include "core/GenerationParams.h"
+#include "core/Parallel.h"
+#include "core/TileTypes.h"
+
+//
+// Searches wall_chance and the GenerationStep list for presets that hit
+// target metrics, instead of trying them by hand in the editor.
+//   cave_tune [--floor F] [--rooms N] [--width W] [--dead-ends N]
+//             [--size 128] [--seeds 3] [--rounds 30] [--population 48]
+//             [--workers N] [--rng 1]
+//
+//   --floor      floor ratio after the CA (0..1)
+//   --rooms      rooms per 100x100 cells
+//   --width      average corridor width in cells (2 x the distance to the
+//                nearest wall along the middle of the floor, less one)
+//   --dead-ends  floor cells with one floor neighbour, per 100x100 cells
+//
+// At least one target is needed, the others aren't scored. Each candidate
+// is generated for --seeds seeds on a --size square map and scored by its
+// mean squared error in units of each metric's tolerance. Each round mutates
+// the best quarter into a new population, evaluated on --workers threads.
+//
+// To keep it quick:
+// - most mutations keep a prefix of the steps and the CA cells after each
+//   prefix (per seed and wall chance) are cached, so only the changed steps
+//   are run (Cave::runSteps / generateFrom)
+// - with a --floor target the floor ratio acceptance rejects caves well off
+//   it before fixUp
+// - a candidate stops after the first seed if it is already far worse
+//   than the best so far
+// - candidates already scored aren't run again
+//
+// The best are printed as cave_bake presets and GDScript.
+//
+namespace {
+
+struct Targets {
+    float floor = -1;
+    float rooms = -1;
+    float width = -1;
+    float deadEnds = -1;
+};
+
+struct Candidate {
+    float wallChance = 0.45f;
+    std::vector<Cave::GenerationStep> steps;
+    double score = INFINITY;
+    // Means over the seeds evaluated
+    float floor = 0;
+    float rooms = 0;
+    float width = 0;
+    float deadEnds = 0;
+};
+
+const int MAX_STEPS = 3;
+const int MAX_REPS = 12;
+
+uint64_t hashMix(uint64_t h, uint32_t v) {
+    // FNV-1a a byte at a time
+    for (int i = 0; i < 4; ++i) {
+        h ^= (v >> (8 * i)) & 0xFF;
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+uint32_t floatBits(float f) {
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+// The CA cells after the first `steps` steps for seed
+uint64_t prefixKey(const Candidate& c, int seed, int steps) {
+    uint64_t h = 14695981039346656037ull;
+    h = hashMix(h, seed);
+    h = hashMix(h, floatBits(c.wallChance));
+    for (int i = 0; i < steps; ++i) {
+        const Cave::GenerationStep& s = c.steps[i];
+        for (int v : {s.b3_min, s.b3_max, s.b5_min, s.b5_max, s.s3_min, s.s3_max,
+                      s.s5_min, s.s5_max, s.reps}) {
+            h = hashMix(h, v);
+        }
+    }
+    return h;
+}
+
+uint64_t candidateKey(const Candidate& c) {
+    return hashMix(prefixKey(c, 0, c.steps.size()), c.steps.size());
+}
+
+//
+// CA cells by prefixKey, shared by the workers. Simply emptied when full,
+// the next round mostly wants the prefixes of the current best anyway.
+//
+class PrefixCache {
+public:
+    explicit PrefixCache(size_t maxEntries) : mMaxEntries(maxEntries) {}
+
+    std::shared_ptr<const std::vector<uint8_t>> get(uint64_t key) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mCells.find(key);
+        return (it == mCells.end()) ? nullptr : it->second;
+    }
+
+    void put(uint64_t key, std::shared_ptr<const std::vector<uint8_t>> cells) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mCells.size() >= mMaxEntries) {
+            mCells.clear();
+        }
+        mCells[key] = std::move(cells);
+    }
+
+private:
+    size_t mMaxEntries;
+    std::mutex mMutex;
+    std::unordered_map<uint64_t, std::shared_ptr<const std::vector<uint8_t>>> mCells;
+};
+
+struct Metrics {
+    bool accepted = false;
+    float floor = 0;
+    float rooms = 0;
+    float width = 0;
+    float deadEnds = 0;
+};
+
+Metrics measure(const Cave::TileMap& tileMap, const Cave::CaveInfo& info,
+                const Cave::GenerationStats& stats) {
+    Metrics m;
+    m.accepted = true;
+    m.floor = stats.mFloorRatio;
+    const int W = info.mCaveWidth;
+    const int H = info.mCaveHeight;
+    const float per10k = 10000.0f / (W * H);
+    m.rooms = stats.mRoomCount * per10k;
+
+    // Ridge cells are at least as far from a wall as their 4 neighbours
+    Cave::DistanceField field(tileMap, info);
+    const std::vector<int> dist = field.getWallDistances();
+    auto distAt = [&](int x, int y) {
+        return (x < 0 || x >= W || y < 0 || y >= H) ? 0 : dist[y * W + x];
+    };
+    double widthSum = 0;
+    int ridges = 0;
+    int deadEnds = 0;
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            const int d = dist[y * W + x];
+            if (d <= 0) {
+                continue;
+            }
+            const int n = distAt(x - 1, y), s = distAt(x + 1, y);
+            const int e = distAt(x, y - 1), w = distAt(x, y + 1);
+            if (d >= n && d >= s && d >= e && d >= w) {
+                widthSum += 2.0 * d / Cave::DistanceField::DIST_ORTHO - 1;
+                ++ridges;
+            }
+            const int floors = (n > 0) + (s > 0) + (e > 0) + (w > 0);
+            deadEnds += (floors == 1);
+        }
+    }
+    m.width = ridges ? (float)(widthSum / ridges) : 0;
+    m.deadEnds = deadEnds * per10k;
+    return m;
+}
+
+double score(const Metrics& m, const Targets& t) {
+    if (!m.accepted) {
+        return 1e6;
+    }
+    double total = 0;
+    auto add = [&](float value, float target, float tolerance) {
+        if (target >= 0) {
+            const double e = (value - target) / tolerance;
+            total += e * e;
+        }
+    };
+    add(m.floor, t.floor, 0.03f);
+    add(m.rooms, t.rooms, std::max(1.0f, 0.15f * t.rooms));
+    add(m.width, t.width, 0.5f);
+    add(m.deadEnds, t.deadEnds, std::max(1.0f, 0.15f * t.deadEnds));
+    return total;
+}
+
+struct Tuner {
+    Targets targets;
+    int size = 128;
+    int seeds = 3;
+    PrefixCache cache{4096};
+    // A candidate stops once a seed scores worse than this
+    double giveUpScore = INFINITY;
+    // Steps run and the ones the cache saved running
+    std::atomic<int64_t> stepsRun{0};
+    std::atomic<int64_t> stepsCached{0};
+
+    int cachedPercent() const {
+        const int64_t total = stepsRun + stepsCached;
+        return total ? (int)(100 * stepsCached / total) : 0;
+    }
+
+    // The CA cells for seed, running only the steps after the longest
+    // cached prefix
+    std::shared_ptr<const std::vector<uint8_t>> runSteps(Cave::Cave& cave, const Candidate& c, int seed) {
+        const int n = c.steps.size();
+        int have = n;
+        std::shared_ptr<const std::vector<uint8_t>> cells;
+        for (; have > 0; --have) {
+            cells = cache.get(prefixKey(c, seed, have));
+            if (cells) {
+                break;
+            }
+        }
+        stepsCached += have;
+        stepsRun += n - have;
+        for (int step = have + 1; step <= n; ++step) {
+            auto next = std::make_shared<const std::vector<uint8_t>>(
+                cave.runSteps(step, cells.get(), step - 1));
+            cache.put(prefixKey(c, seed, step), next);
+            cells = std::move(next);
+        }
+        return cells;
+    }
+
+    void evaluate(Candidate& c) {
+        Cave::CaveInfo info;
+        info.mCaveWidth = size;
+        info.mCaveHeight = size;
+        Cave::GenerationParams params;
+        params.mOctaves = 1;
+        params.mFreq = 13.7f;
+        params.mWallChance = c.wallChance;
+        params.mGenerations = c.steps;
+        params.mThreads = 1;
+        if (targets.floor >= 0) {
+            params.mAccept.mMinFloorRatio = targets.floor - 0.15f;
+            params.mAccept.mMaxFloorRatio = targets.floor + 0.15f;
+        }
+
+        Metrics sum;
+        double total = 0;
+        int done = 0;
+        for (int seed = 1; seed <= seeds; ++seed) {
+            params.seed = seed;
+            Cave::Cave cave(info, params);
+            auto cells = runSteps(cave, c, seed);
+            Cave::TileMap tileMap = cave.generateFrom(*cells);
+            Metrics m;
+            if (!cave.isRejected()) {
+                m = measure(tileMap, info, cave.getStats());
+            }
+            const double s = score(m, targets);
+            total += s;
+            sum.floor += m.floor;
+            sum.rooms += m.rooms;
+            sum.width += m.width;
+            sum.deadEnds += m.deadEnds;
+            ++done;
+            if (s > giveUpScore) {
+                break;
+            }
+        }
+        // Stopping early counts as a bad score for the seeds not run
+        c.score = (total + (seeds - done) * 1e6) / seeds;
+        c.floor = sum.floor / done;
+        c.rooms = sum.rooms / done;
+        c.width = sum.width / done;
+        c.deadEnds = sum.deadEnds / done;
+    }
+};
+
+Cave::GenerationStep randomStep(std::mt19937& rng) {
+    auto pick = [&](int lo, int hi) { return std::uniform_int_distribution<int>(lo, hi)(rng); };
+    Cave::GenerationStep step = {0, 9, 0, 25, 0, 9, 0, 25, 1};
+    step.b3_min = pick(3, 6);
+    step.b3_max = pick(step.b3_min, 9);
+    step.s3_min = pick(1, 5);
+    step.s3_max = pick(step.s3_min, 9);
+    if (pick(0, 3) == 0) {
+        step.b5_min = pick(10, 16);
+        step.b5_max = pick(step.b5_min, 25);
+        step.s5_min = pick(8, 16);
+        step.s5_max = pick(step.s5_min, 25);
+    }
+    step.reps = pick(1, 8);
+    return step;
+}
+
+// Nudge one value of a step
+void tweak(Cave::GenerationStep& step, std::mt19937& rng) {
+    auto pick = [&](int lo, int hi) { return std::uniform_int_distribution<int>(lo, hi)(rng); };
+    int* fields[] = {&step.b3_min, &step.b3_max, &step.s3_min, &step.s3_max, &step.reps,
+                     &step.b5_min, &step.b5_max, &step.s5_min, &step.s5_max};
+    // Only the 5x5 ones if the step uses it
+    const bool uses5x5 = step.b5_min > 0 || step.b5_max < 25 || step.s5_min > 0 || step.s5_max < 25;
+    const int field = pick(0, uses5x5 ? 8 : 4);
+    *fields[field] += pick(0, 1) ? 1 : -1;
+
+    step.reps = std::max(1, std::min(step.reps, MAX_REPS));
+    auto order = [](int& lo, int& hi, int top) {
+        lo = std::max(0, std::min(lo, top));
+        hi = std::max(lo, std::min(hi, top));
+    };
+    order(step.b3_min, step.b3_max, 9);
+    order(step.s3_min, step.s3_max, 9);
+    order(step.b5_min, step.b5_max, 25);
+    order(step.s5_min, step.s5_max, 25);
+}
+
+// Mostly changes the later steps so the CA cells of the earlier ones are
+// cached
+Candidate mutate(const Candidate& parent, std::mt19937& rng) {
+    Candidate c = parent;
+    c.score = INFINITY;
+    const int n = c.steps.size();
+    const int roll = std::uniform_int_distribution<int>(0, 99)(rng);
+    if (roll < 40) {
+        tweak(c.steps[n - 1], rng);
+    } else if (roll < 60) {
+        tweak(c.steps[std::uniform_int_distribution<int>(0, n - 1)(rng)], rng);
+    } else if (roll < 75 && n < MAX_STEPS) {
+        c.steps.push_back(randomStep(rng));
+    } else if (roll < 85 && n > 1) {
+        c.steps.pop_back();
+    } else {
+        const float delta = std::uniform_int_distribution<int>(1, 3)(rng) * 0.025f;
+        c.wallChance += std::uniform_int_distribution<int>(0, 1)(rng) ? delta : -delta;
+        c.wallChance = std::max(0.15f, std::min(c.wallChance, 0.75f));
+        // Keep the keys exact (0.025 steps)
+        c.wallChance = std::round(c.wallChance * 40) / 40;
+    }
+    return c;
+}
+
+void printStep(std::ostream& out, const Cave::GenerationStep& s, bool gdscript) {
+    const bool only3x3 = s.b5_min == 0 && s.b5_max == 25 && s.s5_min == 0 && s.s5_max == 25;
+    if (gdscript) {
+        out << "caveData.add_gen_3x3" << (only3x3 ? "(" : "_5x5(") << s.b3_min << "," << s.b3_max << ", ";
+        if (!only3x3) {
+            out << s.b5_min << "," << s.b5_max << ", ";
+        }
+        out << s.s3_min << "," << s.s3_max << ", ";
+        if (!only3x3) {
+            out << s.s5_min << "," << s.s5_max << ", ";
+        }
+        out << s.reps << ")" << std::endl;
+        return;
+    }
+    out << (only3x3 ? "gen_3x3 " : "gen_3x3_5x5 ") << s.b3_min << " " << s.b3_max << " ";
+    if (!only3x3) {
+        out << s.b5_min << " " << s.b5_max << " ";
+    }
+    out << s.s3_min << " " << s.s3_max << " ";
+    if (!only3x3) {
+        out << s.s5_min << " " << s.s5_max << " ";
+    }
+    out << s.reps << std::endl;
+}
+
+void printCandidate(const Candidate& c, int rank) {
+    std::cout << std::fixed << std::setprecision(2)
+              << "# " << rank << ". score " << c.score << " floor " << c.floor << " rooms "
+              << c.rooms << " width " << c.width << " dead ends " << c.deadEnds << std::endl
+              << "octaves 1" << std::endl
+              << "freq 13.7" << std::endl
+              << "wall_chance " << std::setprecision(3) << c.wallChance << std::endl;
+    for (const auto& step : c.steps) {
+        printStep(std::cout, step, false);
+    }
+    std::cout << "# caveData.wall_chance = " << c.wallChance << std::endl;
+    for (const auto& step : c.steps) {
+        std::cout << "# ";
+        printStep(std::cout, step, true);
+    }
+    std::cout << std::endl;
+}
+
+int usage() {
+    std::cerr << "cave_tune [--floor F] [--rooms N] [--width W] [--dead-ends N]"
+                 " [--size 128] [--seeds 3] [--rounds 30] [--population 48]"
+                 " [--workers N] [--rng 1]" << std::endl;
+    return 2;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Tuner tuner;
+    int rounds = 30;
+    int population = 48;
+    int workers = 0;
+    unsigned rngSeed = 1;
+    for (int i = 1; i < argc; ++i) {
+        const std::string option = argv[i];
+        if (i + 1 >= argc) {
+            return usage();
+        }
+        const float value = std::atof(argv[++i]);
+        if (option == "--floor") {
+            tuner.targets.floor = value;
+        } else if (option == "--rooms") {
+            tuner.targets.rooms = value;
+        } else if (option == "--width") {
+            tuner.targets.width = value;
+        } else if (option == "--dead-ends") {
+            tuner.targets.deadEnds = value;
+        } else if (option == "--size") {
+            tuner.size = std::max(16, (int)value);
+        } else if (option == "--seeds") {
+            tuner.seeds = std::max(1, (int)value);
+        } else if (option == "--rounds") {
+            rounds = std::max(1, (int)value);
+        } else if (option == "--population") {
+            population = std::max(4, (int)value);
+        } else if (option == "--workers") {
+            workers = (int)value;
+        } else if (option == "--rng") {
+            rngSeed = (unsigned)value;
+        } else {
+            return usage();
+        }
+    }
+    const Targets& t = tuner.targets;
+    if (t.floor < 0 && t.rooms < 0 && t.width < 0 && t.deadEnds < 0) {
+        return usage();
+    }
+
+    std::mt19937 rng(rngSeed);
+    std::vector<Candidate> best;
+    std::unordered_map<uint64_t, double> scored;
+    std::vector<Candidate> batch;
+    for (int i = 0; i < population; ++i) {
+        Candidate c;
+        c.wallChance = std::uniform_int_distribution<int>(8, 26)(rng) / 40.0f;
+        const int steps = std::uniform_int_distribution<int>(1, 2)(rng);
+        for (int s = 0; s < steps; ++s) {
+            c.steps.push_back(randomStep(rng));
+        }
+        batch.push_back(c);
+    }
+
+    const int threads = Cave::resolveThreads(workers);
+    for (int round = 0; round < rounds; ++round) {
+        // Drop the ones already scored
+        batch.erase(std::remove_if(batch.begin(), batch.end(),
+                                   [&](const Candidate& c) { return scored.count(candidateKey(c)); }),
+                    batch.end());
+        std::atomic<int> next{0};
+        Cave::parallelFor(std::min(threads, (int)batch.size()), [&](int) {
+            for (int i = next++; i < (int)batch.size(); i = next++) {
+                tuner.evaluate(batch[i]);
+            }
+        });
+        for (Candidate& c : batch) {
+            scored[candidateKey(c)] = c.score;
+            best.push_back(std::move(c));
+        }
+        std::sort(best.begin(), best.end(),
+                  [](const Candidate& a, const Candidate& b) { return a.score < b.score; });
+        if ((int)best.size() > population) {
+            best.resize(population);
+        }
+        tuner.giveUpScore = 4 * best[std::min((int)best.size(), population / 4) - 1].score + 1;
+        std::cout << "round " << round << " best " << std::fixed << std::setprecision(3) << best[0].score
+                  << " floor " << best[0].floor << " rooms " << best[0].rooms << " width "
+                  << best[0].width << " dead ends " << best[0].deadEnds << " steps cached "
+                  << tuner.cachedPercent() << "%" << std::endl;
+
+        // The next round from the best quarter
+        batch.clear();
+        const int parents = std::max(1, (int)best.size() / 4);
+        for (int i = 0; i < population; ++i) {
+            batch.push_back(mutate(best[std::uniform_int_distribution<int>(0, parents - 1)(rng)], rng));
+        }
+    }
+
+    std::cout << std::endl;
+    for (int i = 0; i < std::min(3, (int)best.size()); ++i) {
+        printCandidate(best[i], i + 1);
+    }
+    return 0;
+}